@@ -0,0 +1,50 @@
+#ifndef KMAP_BENCHMARKS_BENCH_H_INCLUDED
+#define KMAP_BENCHMARKS_BENCH_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+//!the benchmarks are plain programs printing one line per measurement. the first argument scales the input
+//!(the number of pairs unless the program says otherwise), without one they finish in a few seconds
+inline uint64_t bench_size(int argc, char** argv, uint64_t fallback)
+{
+    return argc > 1 ? strtoull(argv[1], nullptr, 10) : fallback;
+}
+
+//!the numbers of threads a scaling benchmark runs with: the powers of 2 below the argument at position (the
+//!number of hardware threads without one) and that number itself
+inline std::vector<unsigned> bench_threads(int argc, char** argv, int position)
+{
+    unsigned most = argc > position ? unsigned(atoi(argv[position])) : std::thread::hardware_concurrency();
+    most = most == 0 ? 1 : most;
+    std::vector<unsigned> counts;
+    for (unsigned threads = 1; threads < most; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(most);
+    return counts;
+}
+
+//!seconds taken by the fastest of the runs of fn, prepare is called before every run outside of the timing
+template <class Prepare, class Function>
+double bench_best(int runs, Prepare prepare, Function fn)
+{
+    double best = 0;
+    for (int r = 0; r < runs; r++) {
+        prepare();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        fn();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (r == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+//!the results of the timed loops are added here so the compiler can't drop the loops
+inline volatile uint64_t bench_sink = 0;
+
+#endif // KMAP_BENCHMARKS_BENCH_H_INCLUDED
@@ -0,0 +1,70 @@
+//!cost of an incremental checkpoint against the share of the buckets changed since the last one: the values of
+//!every key in 0.1%, 1%, 10% and 100% of the buckets of a map of n pairs are changed, then checkpoint appends
+//!them to the log. kmap::save of the whole map is the cost of rewriting everything. the first argument is n
+//!(1000000 by default), the files are written to the current directory and removed at the end.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. checkpoint_bench.cpp ../*.cpp -o checkpoint_bench && ./checkpoint_bench
+#include "kmap.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+static const char* image_path = "checkpoint_bench.img";
+static const char* log_path = "checkpoint_bench.log";
+
+static uint64_t file_size(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size < 0 ? 0 : uint64_t(size);
+}
+
+template <class Map>
+static void run(const char* name, uint64_t n)
+{
+    Map map;
+    for (uint64_t k = 0; k < n; k++)
+        map.insert(k, k);
+    double save = bench_best(3, [] {}, [&] { map.save(image_path); });
+    printf("%-12s %llu buckets  save %8.2f ms, %llu bytes\n", name, (unsigned long long)map.hash_size(), save * 1e3,
+           (unsigned long long)file_size(image_path));
+    //!the first checkpoint writes every bucket
+    map.compact(image_path, log_path);
+    const double shares[] = {0.001, 0.01, 0.1, 1};
+    for (uint64_t s = 0; s < sizeof(shares) / sizeof(shares[0]); s++) {
+        uint64_t every = uint64_t(1 / shares[s] + 0.5);
+        uint64_t appended = 0;
+        //!the buckets whose number is a multiple of every are changed before each checkpoint
+        auto change = [&] {
+            for (uint64_t b = 0; b < map.hash_size(); b += every) {
+                std::vector<uint64_t> keys;
+                for (typename Map::bucket_type::const_iterator it = map.batch(b).begin(); it != map.batch(b).end(); ++it)
+                    keys.push_back((*it).first);
+                for (uint64_t i = 0; i < keys.size(); i++)
+                    map.insert_or_assign(keys[i], keys[i] + 1);
+            }
+            appended = file_size(log_path);
+        };
+        double checkpoint = bench_best(3, change, [&] { map.checkpoint(log_path); });
+        appended = file_size(log_path) - appended;
+        printf("%-12s %5.1f%% of the buckets changed  checkpoint %8.2f ms, %llu bytes\n", name, shares[s] * 100,
+               checkpoint * 1e3, (unsigned long long)appended);
+        map.compact(image_path, log_path);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t n = bench_size(argc, argv, 1000000);
+    printf("%llu pairs\n", (unsigned long long)n);
+    run<kmap<uint64_t, uint64_t> >("map_buckets", n);
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >("flat_buckets", n);
+    remove(image_path);
+    remove(log_path);
+    return 0;
+}
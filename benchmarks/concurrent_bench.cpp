@@ -0,0 +1,105 @@
+//!concurrent mode against one mutex around the map: every thread runs 90% find and 10% operator[] on random keys
+//!of a map of n pairs, for 1 thread up to the number of hardware threads. the first argument is n (1000000 by
+//!default), the second the largest number of threads.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. concurrent_bench.cpp ../*.cpp -o concurrent_bench && ./concurrent_bench
+#include "kmap.h"
+#include "bench.h"
+#include <stdint.h>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+static const uint64_t operations = 1000000; //!per thread
+
+//!the map without concurrent mode, every call under the same mutex
+template <class Map>
+struct single_lock
+{
+    Map& map;
+    std::mutex lock;
+    single_lock(Map& input): map(input) {}
+    bool find(uint64_t key)
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        return map.find(key).in_map();
+    }
+    void add(uint64_t key)
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        map[key] += 1;
+    }
+};
+
+//!the map in concurrent mode, the calls go straight to it
+template <class Map>
+struct striped
+{
+    Map& map;
+    striped(Map& input): map(input) {}
+    bool find(uint64_t key)
+    {
+        return map.find(key).in_map();
+    }
+    void add(uint64_t key)
+    {
+        map[key] += 1;
+    }
+};
+
+//!million operations per second of all of the threads together
+template <class Access>
+static double run_threads(Access& access, uint64_t n, unsigned threads)
+{
+    double seconds = bench_best(3, [] {}, [&] {
+        std::vector<std::thread> running;
+        for (unsigned t = 0; t < threads; t++) {
+            running.emplace_back([&access, n, t] {
+                std::mt19937_64 random(t + 1);
+                uint64_t found = 0;
+                for (uint64_t i = 0; i < operations; i++) {
+                    uint64_t key = random() % n;
+                    if (i % 10 == 0)
+                        access.add(key);
+                    else
+                        found += access.find(key);
+                }
+                bench_sink += found;
+            });
+        }
+        for (unsigned t = 0; t < threads; t++)
+            running[t].join();
+    });
+    return operations * threads / seconds / 1e6;
+}
+
+template <class Map>
+static void run(const char* name, uint64_t n, const std::vector<unsigned>& counts)
+{
+    Map map;
+    map.resize(n);
+    for (uint64_t k = 0; k < n; k++)
+        map.insert(k, k);
+    for (uint64_t c = 0; c < counts.size(); c++) {
+        unsigned threads = counts[c];
+        single_lock<Map> locked(map);
+        double mutex_rate = run_threads(locked, n, threads);
+        map.begin_concurrent();
+        striped<Map> concurrent(map);
+        double concurrent_rate = run_threads(concurrent, n, threads);
+        map.end_concurrent();
+        printf("%-12s threads %2u  one mutex %7.2f Mops/s  concurrent mode %7.2f Mops/s\n", name, threads,
+               mutex_rate, concurrent_rate);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t n = bench_size(argc, argv, 1000000);
+    std::vector<unsigned> counts = bench_threads(argc, argv, 2);
+    printf("%llu pairs, 90%% find and 10%% operator[]\n", (unsigned long long)n);
+    run<kmap<uint64_t, uint64_t> >("map_buckets", n, counts);
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >("flat_buckets", n, counts);
+    return 0;
+}
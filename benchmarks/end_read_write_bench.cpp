@@ -0,0 +1,52 @@
+//!end_read_write with n pairs waiting in the write storage of a map of n pairs (half of the waiting keys are new,
+//!half replace a value): the merge (false) and the move of the buckets (true), from 1 thread up to the number of
+//!hardware threads. the first argument is n (1000000 by default, the request was sized for 10000000), the second the
+//!largest number of threads.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. end_read_write_bench.cpp ../*.cpp -o end_read_write_bench && ./end_read_write_bench
+#include "kmap.h"
+#include "bench.h"
+#include <stdint.h>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+template <class Map>
+static void run(const char* name, uint64_t n, const std::vector<unsigned>& counts)
+{
+    std::mt19937_64 random(1);
+    std::vector<std::pair<uint64_t, uint64_t> > base(n);
+    for (uint64_t i = 0; i < n; i++)
+        base[i] = std::make_pair(random(), i);
+    std::vector<std::pair<uint64_t, uint64_t> > pending(n);
+    for (uint64_t i = 0; i < n; i++)
+        pending[i] = std::make_pair(i % 2 == 0 ? base[random() % n].first : random(), i);
+    std::unique_ptr<Map> map;
+    //!the map and its write storage are built again before every run
+    auto prepare = [&] {
+        map.reset(new Map());
+        map->insert_range(base.begin(), base.end());
+        map->begin_read_write(false);
+        for (uint64_t i = 0; i < n; i++)
+            map->insert(pending[i].first, pending[i].second);
+    };
+    for (uint64_t c = 0; c < counts.size(); c++) {
+        unsigned threads = counts[c];
+        double merge = bench_best(2, prepare, [&] { map->end_read_write(false, threads); });
+        bench_sink += map->entry_number();
+        double move = bench_best(2, prepare, [&] { map->end_read_write(true, threads); });
+        bench_sink += map->entry_number();
+        printf("%-12s threads %2u  merge %7.3f s  move %7.3f s\n", name, threads, merge, move);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t n = bench_size(argc, argv, 1000000);
+    std::vector<unsigned> counts = bench_threads(argc, argv, 2);
+    printf("%llu pairs in the map, %llu in the write storage\n", (unsigned long long)n, (unsigned long long)n);
+    run<kmap<uint64_t, uint64_t> >("map_buckets", n, counts);
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >("flat_buckets", n, counts);
+    return 0;
+}
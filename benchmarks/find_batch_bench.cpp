@@ -0,0 +1,72 @@
+//!batched lookups on a map larger than the last level cache: random keys searched with a find loop and with
+//!find_batch and contains_batch in batches of 8 to 512 keys, in nanoseconds per key. the first argument is the
+//!number of pairs (4000000 by default), half of the keys searched are missing.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. find_batch_bench.cpp ../*.cpp -o find_batch_bench && ./find_batch_bench
+#include "kmap.h"
+#include "bench.h"
+#include <stdint.h>
+#include <memory>
+#include <random>
+#include <vector>
+
+static const uint64_t lookups = 2000000;
+
+template <class Map>
+static void run(const char* name, uint64_t n)
+{
+    std::mt19937_64 random(1);
+    Map map;
+    std::vector<uint64_t> keys(n);
+    for (uint64_t i = 0; i < n; i++) {
+        keys[i] = random() | 1;
+        map.insert(keys[i], i);
+    }
+    //!even keys were never inserted
+    std::vector<uint64_t> search(lookups);
+    for (uint64_t i = 0; i < lookups; i++)
+        search[i] = i % 2 == 0 ? keys[random() % n] : random() & ~uint64_t(1);
+    auto nothing = [] {};
+    double loop = bench_best(3, nothing, [&] {
+        uint64_t found = 0;
+        for (uint64_t i = 0; i < lookups; i++)
+            found += map.find(search[i]).in_map();
+        bench_sink += found;
+    });
+    printf("%-12s find loop            %6.1f ns\n", name, loop * 1e9 / lookups);
+    const uint64_t sizes[] = {8, 32, 128, 512};
+    for (uint64_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint64_t size = sizes[s];
+        std::vector<typename Map::iterator> out(size);
+        std::unique_ptr<bool[]> present(new bool[size]);
+        double batched = bench_best(3, nothing, [&] {
+            uint64_t found = 0;
+            for (uint64_t i = 0; i + size <= lookups; i += size) {
+                map.find_batch(&search[i], size, out.data());
+                for (uint64_t j = 0; j < size; j++)
+                    found += out[j].in_map();
+            }
+            bench_sink += found;
+        });
+        double contains = bench_best(3, nothing, [&] {
+            uint64_t found = 0;
+            for (uint64_t i = 0; i + size <= lookups; i += size) {
+                map.contains_batch(&search[i], size, present.get());
+                for (uint64_t j = 0; j < size; j++)
+                    found += present[j];
+            }
+            bench_sink += found;
+        });
+        printf("%-12s batches of %3llu  find_batch %6.1f ns  contains_batch %6.1f ns\n", name,
+               (unsigned long long)size, batched * 1e9 / lookups, contains * 1e9 / lookups);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t n = bench_size(argc, argv, 4000000);
+    printf("%llu pairs, %llu lookups per measurement\n", (unsigned long long)n, (unsigned long long)lookups);
+    run<kmap<uint64_t, uint64_t> >("map_buckets", n);
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >("flat_buckets", n);
+    return 0;
+}
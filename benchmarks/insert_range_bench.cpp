@@ -0,0 +1,57 @@
+//!startup load: n random pairs put into an empty kmap by an insert loop, by an insert loop after resize and by
+//!insert_range with 1 and with all of the threads. the first argument is n (2000000 by default).
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. insert_range_bench.cpp ../*.cpp -o insert_range_bench && ./insert_range_bench
+#include "kmap.h"
+#include "bench.h"
+#include <stdint.h>
+#include <memory>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template <class Map>
+static void run(const char* name, const std::vector<std::pair<uint64_t, uint64_t> >& pairs)
+{
+    unsigned threads = std::thread::hardware_concurrency();
+    threads = threads == 0 ? 1 : threads;
+    uint64_t n = pairs.size();
+    std::unique_ptr<Map> map;
+    auto reset = [&] { map.reset(); };
+    double loop = bench_best(3, reset, [&] {
+        map.reset(new Map());
+        for (uint64_t i = 0; i < n; i++)
+            map->insert(pairs[i].first, pairs[i].second);
+    });
+    double presized = bench_best(3, reset, [&] {
+        map.reset(new Map());
+        map->resize(n);
+        for (uint64_t i = 0; i < n; i++)
+            map->insert(pairs[i].first, pairs[i].second);
+    });
+    double range = bench_best(3, reset, [&] {
+        map.reset(new Map());
+        map->insert_range(pairs.begin(), pairs.end());
+    });
+    double parallel = bench_best(3, reset, [&] {
+        map.reset(new Map());
+        map->insert_range(pairs.begin(), pairs.end(), threads);
+    });
+    bench_sink += map->entry_number();
+    printf("%-12s insert loop %7.3f s  resize + loop %7.3f s  insert_range %7.3f s  on %u threads %7.3f s\n",
+           name, loop, presized, range, threads, parallel);
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t n = bench_size(argc, argv, 2000000);
+    std::mt19937_64 random(1);
+    std::vector<std::pair<uint64_t, uint64_t> > pairs(n);
+    for (uint64_t i = 0; i < n; i++)
+        pairs[i] = std::make_pair(random(), i);
+    printf("%llu pairs with random keys\n", (unsigned long long)n);
+    run<kmap<uint64_t, uint64_t> >("map_buckets", pairs);
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >("flat_buckets", pairs);
+    return 0;
+}
@@ -0,0 +1,68 @@
+//!iteration over maps whose buckets are 1%, 10% and 100% occupied (presized for 16 times the pairs so a bucket
+//!holds about 4 of them, filled and then emptied bucket by bucket with remove): begin() to end() with the
+//!occupancy bitmap against a loop checking every bucket with batch().empty(), in nanoseconds per bucket of the
+//!table. the first argument is the number of pairs before the removes (1000000 by default).
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. iteration_bench.cpp ../*.cpp -o iteration_bench && ./iteration_bench
+#include "kmap.h"
+#include "bench.h"
+#include <stdint.h>
+#include <vector>
+
+template <class Map>
+static void run(const char* name, uint64_t n)
+{
+    const uint64_t percents[] = {1, 10, 100};
+    for (uint64_t p = 0; p < 3; p++) {
+        Map map;
+        map.resize(n * 16);
+        for (uint64_t k = 0; k < n; k++)
+            map.insert(k, k);
+        //!the buckets whose number is percents[p] or more modulo 100 are emptied
+        std::vector<uint64_t> removed;
+        for (uint64_t b = 0; b < map.hash_size(); b++) {
+            if (b % 100 < percents[p])
+                continue;
+            for (typename Map::bucket_type::const_iterator it = map.batch(b).begin(); it != map.batch(b).end(); ++it)
+                removed.push_back((*it).first);
+        }
+        for (uint64_t i = 0; i < removed.size(); i++)
+            map.remove(removed[i]);
+        const Map& view = map;
+        auto nothing = [] {};
+        double iterator = bench_best(5, nothing, [&] {
+            uint64_t sum = 0;
+            for (typename Map::iterator it = map.begin(); it != map.end(); ++it)
+                sum += it->second;
+            bench_sink += sum;
+        });
+        double const_iterator = bench_best(5, nothing, [&] {
+            uint64_t sum = 0;
+            for (typename Map::const_iterator it = view.begin(); it != view.end(); ++it)
+                sum += it->second;
+            bench_sink += sum;
+        });
+        double buckets = bench_best(5, nothing, [&] {
+            uint64_t sum = 0;
+            for (uint64_t b = 0; b < view.hash_size(); b++) {
+                if (view.batch(b).empty())
+                    continue;
+                for (typename Map::bucket_type::const_iterator it = view.batch(b).begin(); it != view.batch(b).end(); ++it)
+                    sum += (*it).second;
+            }
+            bench_sink += sum;
+        });
+        double size = double(map.hash_size());
+        printf("%-12s %3llu%% of %llu buckets  iterator %6.2f ns  const_iterator %6.2f ns  every bucket %6.2f ns\n", name,
+               (unsigned long long)percents[p], (unsigned long long)map.hash_size(), iterator * 1e9 / size,
+               const_iterator * 1e9 / size, buckets * 1e9 / size);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t n = bench_size(argc, argv, 1000000);
+    run<kmap<uint64_t, uint64_t> >("map_buckets", n);
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >("flat_buckets", n);
+    return 0;
+}
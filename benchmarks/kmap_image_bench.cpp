@@ -0,0 +1,83 @@
+//!startup from a saved image against rebuilding the map: n pairs (random keys, string values of 8 to 40 bytes)
+//!inserted into an empty kmap, against kmap_view::open of the image saved by kmap::save followed by 10000 lookups
+//!and by a scan of every pair. on linux the pages of the image are dropped from the page cache before every open
+//!so the view starts cold. the first argument is n (1000000 by default), the image is written to the current
+//!directory and removed at the end.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. kmap_image_bench.cpp ../*.cpp -o kmap_image_bench && ./kmap_image_bench
+#include "kmap.h"
+#include "kmap_view.h"
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char* image_path = "kmap_image_bench.img";
+static const uint64_t lookups = 10000;
+
+//!the image was fsynced by save, so its pages are clean and the kernel can drop them
+static void drop_cache()
+{
+#if defined(__linux__)
+    int file = open(image_path, O_RDONLY);
+    if (file >= 0) {
+        int result = posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+        (void)result;
+        close(file);
+    }
+#endif
+}
+
+template <class Map>
+static void run(const char* name, uint64_t n)
+{
+    typedef kmap_view<uint64_t, std::string> view_type;
+    std::mt19937_64 random(1);
+    std::vector<std::pair<uint64_t, std::string> > pairs(n);
+    for (uint64_t i = 0; i < n; i++)
+        pairs[i] = std::make_pair(random(), std::string(8 + i % 33, char('a' + i % 26)));
+    std::vector<uint64_t> search(lookups);
+    for (uint64_t i = 0; i < lookups; i++)
+        search[i] = pairs[random() % n].first;
+    std::unique_ptr<Map> map;
+    double rebuild = bench_best(3, [&] { map.reset(); }, [&] {
+        map.reset(new Map());
+        for (uint64_t i = 0; i < n; i++)
+            map->insert(pairs[i].first, pairs[i].second);
+    });
+    double save = bench_best(3, [] {}, [&] { map->save(image_path); });
+    double open_find = bench_best(3, drop_cache, [&] {
+        view_type view = view_type::open(image_path);
+        uint64_t bytes = 0;
+        for (uint64_t i = 0; i < lookups; i++)
+            bytes += view.at(search[i]).size();
+        bench_sink += bytes;
+    });
+    double open_scan = bench_best(3, drop_cache, [&] {
+        view_type view = view_type::open(image_path);
+        uint64_t bytes = 0;
+        for (view_type::const_iterator it = view.begin(); it != view.end(); ++it)
+            bytes += it.value().size();
+        bench_sink += bytes;
+    });
+    printf("%-12s insert %7.3f s  save %7.3f s  open + %llu lookups %7.3f s  open + scan %7.3f s\n", name,
+           rebuild, save, (unsigned long long)lookups, open_find, open_scan);
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t n = bench_size(argc, argv, 1000000);
+    printf("%llu pairs\n", (unsigned long long)n);
+    run<kmap<uint64_t, std::string> >("map_buckets", n);
+    run<kmap<uint64_t, std::string, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >("flat_buckets", n);
+    remove(image_path);
+    return 0;
+}
@@ -0,0 +1,71 @@
+//!read scaling of concurrent mode with lock free reads against the shared bucket locks: every thread runs visit
+//!on random keys of a map of n pairs, with no writes and with 5% insert_or_assign, for 1 thread up to the number
+//!of hardware threads. the first argument is n (1000000 by default), the second the largest number of threads.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. lock_free_reads_bench.cpp ../*.cpp -o lock_free_reads_bench && ./lock_free_reads_bench
+#include "kmap.h"
+#include "bench.h"
+#include <stdint.h>
+#include <random>
+#include <thread>
+#include <vector>
+
+static const uint64_t operations = 1000000; //!per thread
+
+//!million operations per second of all of the threads together, writes out of every 100 operations
+template <class Map>
+static double run_threads(Map& map, uint64_t n, unsigned threads, uint64_t writes)
+{
+    double seconds = bench_best(3, [] {}, [&] {
+        std::vector<std::thread> running;
+        for (unsigned t = 0; t < threads; t++) {
+            running.emplace_back([&map, n, t, writes] {
+                std::mt19937_64 random(t + 1);
+                uint64_t sum = 0;
+                for (uint64_t i = 0; i < operations; i++) {
+                    uint64_t key = random() % n;
+                    if (i % 100 < writes)
+                        map.insert_or_assign(key, i);
+                    else
+                        map.visit(key, [&sum](uint64_t value) { sum += value; });
+                }
+                bench_sink += sum;
+            });
+        }
+        for (unsigned t = 0; t < threads; t++)
+            running[t].join();
+    });
+    return operations * threads / seconds / 1e6;
+}
+
+template <class Map>
+static void run(const char* name, uint64_t n, const std::vector<unsigned>& counts)
+{
+    Map map;
+    map.resize(n);
+    for (uint64_t k = 0; k < n; k++)
+        map.insert(k, k);
+    const uint64_t writes[] = {0, 5};
+    for (uint64_t w = 0; w < 2; w++) {
+        for (uint64_t c = 0; c < counts.size(); c++) {
+            map.begin_concurrent(false);
+            double locked = run_threads(map, n, counts[c], writes[w]);
+            map.end_concurrent();
+            map.begin_concurrent(true);
+            double lock_free = run_threads(map, n, counts[c], writes[w]);
+            map.end_concurrent();
+            printf("%-12s %llu%% writes  threads %2u  shared locks %7.2f Mops/s  lock free reads %7.2f Mops/s\n", name,
+                   (unsigned long long)writes[w], counts[c], locked, lock_free);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t n = bench_size(argc, argv, 1000000);
+    std::vector<unsigned> counts = bench_threads(argc, argv, 2);
+    printf("%llu pairs, visit and insert_or_assign\n", (unsigned long long)n);
+    run<kmap<uint64_t, uint64_t> >("map_buckets", n, counts);
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >("flat_buckets", n, counts);
+    return 0;
+}
@@ -0,0 +1,85 @@
+//!parallel_for_each and parallel_reduce on skewed buckets: an eighth of the keys of a map of n pairs share 64
+//!hash values, so a few buckets hold thousands of pairs. compared with a serial loop and with threads which get
+//!the same number of buckets each, from 1 thread up to the number of hardware threads. the first argument is n
+//!(1000000 by default), the second the largest number of threads.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. parallel_for_each_bench.cpp ../*.cpp -o parallel_for_each_bench && ./parallel_for_each_bench
+#include "kmap.h"
+#include "work_pool.h"
+#include "bench.h"
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+//!every key which is a multiple of 8 gets one of 64 hash values
+struct skewed_hash
+{
+    unsigned long long operator()(uint64_t key) const
+    {
+        return key % 8 == 0 ? (key / 8 % 64) * 0x9e3779b97f4a7c15ULL : key * 0xff51afd7ed558ccdULL;
+    }
+};
+
+//!some work for every pair so the loops are bound by the processor
+static uint64_t mix(uint64_t x)
+{
+    for (int r = 0; r < 32; r++)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    return x;
+}
+
+template <class Map>
+static void run(const char* name, uint64_t n, const std::vector<unsigned>& counts)
+{
+    Map map;
+    for (uint64_t k = 0; k < n; k++)
+        map.insert(k, k);
+    uint64_t largest = 0;
+    for (uint64_t b = 0; b < map.hash_size(); b++)
+        largest = map.batch(b).size() > largest ? map.batch(b).size() : largest;
+    printf("%-12s %llu buckets, the largest holds %llu pairs\n", name, (unsigned long long)map.hash_size(),
+           (unsigned long long)largest);
+    auto nothing = [] {};
+    double serial = bench_best(3, nothing, [&] {
+        for (typename Map::iterator it = map.begin(); it != map.end(); ++it)
+            it->second = mix(it->second);
+    });
+    printf("%-12s serial loop %7.3f s\n", name, serial);
+    for (uint64_t c = 0; c < counts.size(); c++) {
+        unsigned threads = counts[c];
+        work_pool pool(threads);
+        //!thread t gets the buckets [t * size / threads, (t + 1) * size / threads)
+        double even = bench_best(3, nothing, [&] {
+            std::vector<std::thread> running;
+            for (unsigned t = 0; t < threads; t++) {
+                running.emplace_back([&map, t, threads] {
+                    uint64_t size = map.hash_size();
+                    for (uint64_t b = t * size / threads; b < (t + 1) * size / threads; b++)
+                        for (typename Map::bucket_type::iterator it = map.batch(b).begin(); it != map.batch(b).end(); ++it)
+                            it->second = mix(it->second);
+                });
+            }
+            for (unsigned t = 0; t < threads; t++)
+                running[t].join();
+        });
+        double for_each = bench_best(3, nothing, [&] {
+            map.parallel_for_each([](auto& pair) { pair.second = mix(pair.second); }, pool);
+        });
+        const Map& view = map;
+        double reduce = bench_best(3, nothing, [&] {
+            bench_sink += view.parallel_reduce(uint64_t(0), [](uint64_t a, uint64_t b) { return a + b; },
+                                               [](const auto& pair) { return mix(pair.second); }, pool);
+        });
+        printf("%-12s threads %2u  even bucket ranges %7.3f s  parallel_for_each %7.3f s  parallel_reduce %7.3f s\n",
+               name, threads, even, for_each, reduce);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t n = bench_size(argc, argv, 1000000);
+    std::vector<unsigned> counts = bench_threads(argc, argv, 2);
+    run<kmap<uint64_t, uint64_t, skewed_hash> >("map_buckets", n, counts);
+    run<kmap<uint64_t, uint64_t, skewed_hash, fibonacci_index, flat_buckets> >("flat_buckets", n, counts);
+    return 0;
+}
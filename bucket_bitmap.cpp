@@ -0,0 +1,79 @@
+#include "bucket_bitmap.h"
+
+bucket_bitmap::bucket_bitmap(): bucket_bitmap(0)
+{
+}
+
+bucket_bitmap::bucket_bitmap(uint64_t size): words(new std::atomic<uint64_t>[word_count(size)]), bits(size)
+{
+    for (uint64_t w = 0; w < word_count(size); w++)
+        words[w].store(0, std::memory_order_relaxed);
+    words[size >> 6].store(uint64_t(1) << (size & 63), std::memory_order_relaxed);
+}
+
+bucket_bitmap::bucket_bitmap(const bucket_bitmap& input): words(new std::atomic<uint64_t>[word_count(input.bits)]), bits(input.bits)
+{
+    for (uint64_t w = 0; w < word_count(bits); w++)
+        words[w].store(input.words[w].load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+bucket_bitmap& bucket_bitmap::operator=(const bucket_bitmap& input)
+{
+    if (this != &input) {
+        bucket_bitmap copy(input);
+        swap(copy);
+    }
+    return *this;
+}
+
+bucket_bitmap::bucket_bitmap(bucket_bitmap&& input) noexcept: words(input.words), bits(input.bits)
+{
+    input.words = nullptr;
+    input.bits = 0;
+}
+
+bucket_bitmap& bucket_bitmap::operator=(bucket_bitmap&& input) noexcept
+{
+    swap(input);
+    return *this;
+}
+
+bucket_bitmap::~bucket_bitmap()
+{
+    delete[] words;
+}
+
+void bucket_bitmap::resize(uint64_t size)
+{
+    std::atomic<uint64_t>* result = new std::atomic<uint64_t>[word_count(size)];
+    uint64_t kept = size < bits ? size : bits;
+    for (uint64_t w = 0; w < word_count(size); w++) {
+        uint64_t word = 0;
+        if (w * 64 < kept) {
+            word = words[w].load(std::memory_order_relaxed);
+            if (kept - w * 64 < 64)
+                word &= (uint64_t(1) << (kept - w * 64)) - 1; //!drops the old end marker and the dropped buckets
+        }
+        result[w].store(word, std::memory_order_relaxed);
+    }
+    result[size >> 6].fetch_or(uint64_t(1) << (size & 63), std::memory_order_relaxed);
+    delete[] words;
+    words = result;
+    bits = size;
+}
+
+void bucket_bitmap::swap(bucket_bitmap& other)
+{
+    std::atomic<uint64_t>* held = words;
+    words = other.words;
+    other.words = held;
+    uint64_t size = bits;
+    bits = other.bits;
+    other.bits = size;
+}
+
+//!one more bit than there are buckets for the end marker
+uint64_t bucket_bitmap::word_count(uint64_t size)
+{
+    return (size >> 6) + 1;
+}
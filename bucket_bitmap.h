@@ -0,0 +1,73 @@
+#ifndef BUCKET_BITMAP_H_INCLUDED
+#define BUCKET_BITMAP_H_INCLUDED
+
+#include <stdint.h>
+#include <atomic>
+
+//!one bit per bucket of a kmap telling whether the bucket may hold pairs, so iteration jumps over empty buckets
+//!64 at a time instead of looking at every one of them. a clear bit promises an empty bucket, a set bit doesn't
+//!promise a pair (the bit of a bucket which was emptied may still be set), so the bucket is checked as well.
+//!the words are atomic so threads filling different buckets of the same word can mark them at once.
+//!the bit right after the last bucket is always set, so a scan stops there without knowing the size
+class bucket_bitmap
+{
+public:
+    bucket_bitmap();
+    explicit bucket_bitmap(uint64_t); //!number of buckets, all of them clear
+    bucket_bitmap(const bucket_bitmap&);
+    bucket_bitmap& operator=(const bucket_bitmap&);
+    bucket_bitmap(bucket_bitmap&&) noexcept; //!the moved from bitmap can only be assigned to or destroyed
+    bucket_bitmap& operator=(bucket_bitmap&&) noexcept;
+    ~bucket_bitmap();
+    void resize(uint64_t); //!the kept buckets keep their bits, the new ones are clear
+    void swap(bucket_bitmap&);
+    uint64_t size() const {return bits;}
+    //!the words are only written when the bit changes, so marking a bucket which is marked already costs a load
+    void set(uint64_t index)
+    {
+        uint64_t bit = uint64_t(1) << (index & 63);
+        if ((words[index >> 6].load(std::memory_order_relaxed) & bit) == 0)
+            words[index >> 6].fetch_or(bit, std::memory_order_relaxed);
+    }
+    void reset(uint64_t index)
+    {
+        uint64_t bit = uint64_t(1) << (index & 63);
+        if ((words[index >> 6].load(std::memory_order_relaxed) & bit) != 0)
+            words[index >> 6].fetch_and(~bit, std::memory_order_relaxed);
+    }
+    bool test(uint64_t index) const
+    {
+        return (words[index >> 6].load(std::memory_order_relaxed) >> (index & 63)) & 1;
+    }
+    const std::atomic<uint64_t>* data() const {return words;} //!kept by the iterators, which scan it with next
+    uint64_t next(uint64_t from) const {return next(words, from);}
+    //!first set bit from the input on (at most the size), the input can't be past the size
+    static uint64_t next(const std::atomic<uint64_t>* input, uint64_t from)
+    {
+        uint64_t w = from >> 6;
+        uint64_t word = input[w].load(std::memory_order_relaxed) & (~uint64_t(0) << (from & 63));
+        while (word == 0)
+            word = input[++w].load(std::memory_order_relaxed);
+        return (w << 6) + lowest(word);
+    }
+private:
+    std::atomic<uint64_t>* words;
+    uint64_t bits;
+    static uint64_t word_count(uint64_t);
+    //!position of the lowest set bit, word must not be 0
+    static uint64_t lowest(uint64_t word)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctzll(word);
+#else
+        uint64_t i = 0;
+        while ((word & 1) == 0) {
+            word >>= 1;
+            i++;
+        }
+        return i;
+#endif
+    }
+};
+
+#endif // BUCKET_BITMAP_H_INCLUDED
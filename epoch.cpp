@@ -0,0 +1,151 @@
+#include "epoch.h"
+#include <stdexcept>
+
+const unsigned epoch_domain::max_threads = 256;
+const size_t epoch_domain::collect_threshold = 64;
+
+namespace
+{
+    //!hands every thread a slot number below max_threads, the number is given back when the thread exits
+    class thread_numbers
+    {
+    public:
+        thread_numbers(): next(0) {}
+        unsigned take()
+        {
+            lock.set_lock(true);
+            unsigned result;
+            if (!released.empty()) {
+                result = released.back();
+                released.pop_back();
+            }
+            else
+                result = next++;
+            lock.set_lock(false);
+            return result;
+        }
+        void give_back(unsigned number)
+        {
+            lock.set_lock(true);
+            released.push_back(number);
+            lock.set_lock(false);
+        }
+    private:
+        unsigned next;
+        std::vector<unsigned> released;
+        global_lock lock;
+    };
+
+    thread_numbers& numbers()
+    {
+        static thread_numbers result;
+        return result;
+    }
+
+    struct thread_number
+    {
+        thread_number(): value(numbers().take()) {}
+        ~thread_number() {numbers().give_back(value);}
+        unsigned value;
+    };
+
+    unsigned current_thread()
+    {
+        thread_local thread_number number;
+        if (number.value >= epoch_domain::max_threads)
+            throw std::length_error("more threads than epoch_domain::max_threads are using an epoch_domain");
+        return number.value;
+    }
+}
+
+epoch_domain::epoch_domain(): slots(new slot[max_threads]), global_epoch(1)
+{
+    for (unsigned i = 0; i < max_threads; i++) {
+        slots[i].epoch.store(0, std::memory_order_relaxed);
+        slots[i].depth = 0;
+    }
+}
+
+epoch_domain::~epoch_domain()
+{
+    for (size_t i = 0; i < limbo.size(); i++)
+        limbo[i].deleter(limbo[i].object);
+    delete[] slots;
+}
+
+//!the announcement is sequentially consistent so a writer scanning the slots after unlinking an object
+//!either sees this reader or the reader sees the object unlinked
+void epoch_domain::enter()
+{
+    slot& own = slots[current_thread()];
+    if (own.depth++ == 0)
+        own.epoch.store(global_epoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+}
+
+void epoch_domain::leave()
+{
+    slot& own = slots[current_thread()];
+    if (--own.depth == 0)
+        own.epoch.store(0, std::memory_order_release);
+}
+
+void epoch_domain::retire(void* object, void (*deleter)(void*))
+{
+    lock.set_lock(true);
+    retired entry = {object, deleter, global_epoch.load(std::memory_order_seq_cst)};
+    try {
+        limbo.push_back(entry);
+    }
+    catch (...) {
+        lock.set_lock(false);
+        throw;
+    }
+    //!scanning every slot costs a few kilobytes of reads, so it is only done once enough objects wait
+    if (limbo.size() >= collect_threshold) {
+        if (try_advance())
+            free_retired(global_epoch.load(std::memory_order_relaxed));
+    }
+    lock.set_lock(false);
+}
+
+void epoch_domain::collect()
+{
+    lock.set_lock(true);
+    try_advance();
+    free_retired(global_epoch.load(std::memory_order_relaxed));
+    lock.set_lock(false);
+}
+
+size_t epoch_domain::pending() const
+{
+    lock.set_lock(true);
+    size_t result = limbo.size();
+    lock.set_lock(false);
+    return result;
+}
+
+//!the epoch can only move on once every reader inside has seen the current one
+bool epoch_domain::try_advance()
+{
+    uint64_t current = global_epoch.load(std::memory_order_relaxed);
+    for (unsigned i = 0; i < max_threads; i++) {
+        uint64_t seen = slots[i].epoch.load(std::memory_order_seq_cst);
+        if (seen != 0 && seen != current)
+            return false;
+    }
+    global_epoch.store(current + 1, std::memory_order_seq_cst);
+    return true;
+}
+
+//!readers can still be in the epoch before the current one, so only objects retired before that are freed
+void epoch_domain::free_retired(uint64_t current)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < limbo.size(); i++) {
+        if (limbo[i].epoch + 2 <= current)
+            limbo[i].deleter(limbo[i].object);
+        else
+            limbo[kept++] = limbo[i];
+    }
+    limbo.resize(kept);
+}
@@ -0,0 +1,62 @@
+#ifndef EPOCH_H_INCLUDED
+#define EPOCH_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "global_lock.h"
+
+//!epoch based reclamation: lets readers follow pointers without taking locks while writers replace the objects.
+//!a reader announces the epoch it entered in a slot owned by its thread (no other thread writes that cache line),
+//!a writer retires the objects it unlinked and they are only freed once every reader which could still
+//!reach them has left, which is two epochs after they were retired.
+//!every thread gets a slot the first time it enters, at most max_threads threads may use a domain at once
+class epoch_domain
+{
+public:
+    epoch_domain();
+    epoch_domain(const epoch_domain&) = delete;
+    epoch_domain& operator=(const epoch_domain&) = delete;
+    ~epoch_domain(); //!frees every retired object, no reader may be inside any more
+    void enter(); //!readers, can be nested
+    void leave();
+    //!writers: the object has been unlinked and is freed with deleter once no reader can reach it
+    void retire(void*, void (*)(void*));
+    void collect(); //!tries to advance the epoch and frees what can be freed
+    size_t pending() const; //!number of retired objects not freed yet
+    static const unsigned max_threads;
+private:
+    struct alignas(64) slot
+    {
+        std::atomic<uint64_t> epoch; //0 while the thread is outside
+        unsigned depth; //only touched by the thread owning the slot
+    };
+    struct retired
+    {
+        void* object;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+    static const size_t collect_threshold; //!retired objects which trigger a collection
+    slot* slots;
+    std::atomic<uint64_t> global_epoch;
+    std::vector<retired> limbo;
+    mutable global_lock lock;
+    bool try_advance();
+    void free_retired(uint64_t);
+};
+
+//!holds the epoch of the calling thread for as long as it exists
+class epoch_guard
+{
+public:
+    explicit epoch_guard(epoch_domain& input): domain(input) {domain.enter();}
+    epoch_guard(const epoch_guard&) = delete;
+    epoch_guard& operator=(const epoch_guard&) = delete;
+    ~epoch_guard() {domain.leave();}
+private:
+    epoch_domain& domain;
+};
+
+#endif // EPOCH_H_INCLUDED
@@ -0,0 +1,925 @@
+#ifndef FLAT_BUCKET_H_INCLUDED
+#define FLAT_BUCKET_H_INCLUDED
+
+#include "hash_methods.h"
+#include "kvector.h"
+#include <stdint.h>
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <tuple>
+#include <utility>
+
+//!KMAP_SIMD selects how flat_bucket compares its control bytes
+//!2 = AVX2 (32 bytes per group), 1 = SSE2 (16 bytes per group), 0 = portable scalar loop (16 bytes per group)
+//!by default the widest instruction set enabled for the compiler is used.
+//!define KMAP_SIMD=0 before including this header to force the scalar version, the results are identical.
+#ifndef KMAP_SIMD
+#if defined(__AVX2__)
+#define KMAP_SIMD 2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KMAP_SIMD 1
+#else
+#define KMAP_SIMD 0
+#endif
+#endif
+
+#if KMAP_SIMD == 2
+#include <immintrin.h>
+#elif KMAP_SIMD == 1
+#include <emmintrin.h>
+#endif
+
+//!KMAP_PREFETCH(address) asks the cpu to start loading a cache line which is needed soon, used by the batched lookups.
+//!it can be defined before including this header, defining it as nothing turns prefetching off
+#ifndef KMAP_PREFETCH
+#if defined(__GNUC__) || defined(__clang__)
+#define KMAP_PREFETCH(address) __builtin_prefetch(address)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define KMAP_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#else
+#define KMAP_PREFETCH(address)
+#endif
+#endif
+
+//!flat_group compares a group of control bytes at once and returns a bit mask
+//!with bit i set when byte i of the group matches.
+//!control bytes: 0..127 = full slot holding the 7 bit fingerprint of its key, empty = -128, deleted = -2
+struct flat_group
+{
+    static const signed char empty = -128;
+    static const signed char deleted = -2;
+#if KMAP_SIMD == 2
+    static const uint64_t width = 32;
+    static uint32_t match(const signed char* group, signed char fingerprint)
+    {
+        __m256i ctrl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(group));
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi8(ctrl, _mm256_set1_epi8(fingerprint)));
+    }
+    static uint32_t match_empty(const signed char* group)
+    {
+        return match(group, empty);
+    }
+    //!empty and deleted are the only negative control bytes so the sign bits are the mask
+    static uint32_t match_free(const signed char* group)
+    {
+        return _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(group)));
+    }
+#elif KMAP_SIMD == 1
+    static const uint64_t width = 16;
+    static uint32_t match(const signed char* group, signed char fingerprint)
+    {
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(fingerprint)));
+    }
+    static uint32_t match_empty(const signed char* group)
+    {
+        return match(group, empty);
+    }
+    static uint32_t match_free(const signed char* group)
+    {
+        return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group)));
+    }
+#else
+    static const uint64_t width = 16;
+    static uint32_t match(const signed char* group, signed char fingerprint)
+    {
+        uint32_t mask = 0;
+        for (uint64_t i = 0; i < width; i++) {
+            if (group[i] == fingerprint)
+                mask |= 1u << i;
+        }
+        return mask;
+    }
+    static uint32_t match_empty(const signed char* group)
+    {
+        return match(group, empty);
+    }
+    static uint32_t match_free(const signed char* group)
+    {
+        uint32_t mask = 0;
+        for (uint64_t i = 0; i < width; i++) {
+            if (group[i] < 0)
+                mask |= 1u << i;
+        }
+        return mask;
+    }
+#endif
+    //!position of the lowest set bit, mask must not be 0
+    static uint64_t first(uint32_t mask)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctz(mask);
+#else
+        uint64_t i = 0;
+        while ((mask & 1u) == 0) {
+            mask >>= 1;
+            i++;
+        }
+        return i;
+#endif
+    }
+};
+
+//!flat_bucket is an alternative to std::map for the slots of kmap.
+//!The key-value pairs are kept in one contiguous open-addressed array split into groups of flat_group::width slots.
+//!Next to the pairs is an array of one byte control values holding a 7 bit fingerprint of each key,
+//!so a lookup compares a whole group of fingerprints at once and only compares keys whose fingerprint matches.
+//!Keys only need operator== (std::map needed operator<) and the hash policy H.
+//!note erasing leaves a tombstone in place, so erasing never moves the other
+//!key-value pairs and iterators to them stay valid until the next insert.
+
+//!the allocator A hands out the block holding the control bytes and the slots (rebound to std::max_align_t units)
+template <class K, class V, class H = default_kmap_hash<K>, class A = std::allocator<std::pair<const K, V> > >
+class flat_bucket
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef A allocator_type;
+
+    class iterator;
+    class const_iterator;
+    class node_type;
+    struct insert_return_type;
+
+    flat_bucket();
+    explicit flat_bucket(const A&);
+    flat_bucket(const flat_bucket&);
+    flat_bucket(const flat_bucket&, const A&);
+    flat_bucket(flat_bucket&&);
+    flat_bucket& operator=(const flat_bucket&);
+    flat_bucket& operator=(flat_bucket&&);
+    ~flat_bucket();
+
+    iterator find(const K&);
+    const_iterator find(const K&) const;
+    V& operator[](const K&);
+    //!builds the value from the arguments only when the key is new, returns the position and whether it was inserted
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K&, Args&&...);
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K&&, Args&&...);
+    uint64_t erase(const K&);
+    //!lookups with a type that compares equal to K (std::string_view for std::string keys), only when H is transparent
+    template <class Q, class Hash = H, class = typename std::enable_if<is_transparent_hash<Hash>::value>::type>
+    iterator find(const Q&);
+    template <class Q, class Hash = H, class = typename std::enable_if<is_transparent_hash<Hash>::value>::type>
+    const_iterator find(const Q&) const;
+    template <class Q, class Hash = H, class = typename std::enable_if<is_transparent_hash<Hash>::value>::type>
+    uint64_t erase(const Q&);
+    node_type extract(iterator); //!removes the pair from the bucket and returns it in a node, like std::map::extract
+    insert_return_type insert(node_type&&); //!inserts the pair held by the node unless the key already exists
+    void clear();
+    void swap(flat_bucket&);
+
+    iterator begin();
+    const_iterator begin() const;
+    iterator end();
+    const_iterator end() const;
+    bool empty() const;
+    uint64_t size() const;
+    A get_allocator() const;
+    template <class Q>
+    void prefetch(const Q&) const; //!prefetches the group of control bytes and slots a lookup of the key starts at
+private:
+    static const uint64_t init_capacity = flat_group::width;
+    typedef typename std::allocator_traits<A>::template rebind_alloc<std::max_align_t> block_allocator;
+    typedef std::allocator_traits<A> alloc_traits;
+
+    signed char* ctrl; //!one control byte per slot, the slots are stored in the same block right after the control bytes
+    value_type* slots;
+    uint64_t capacity; //!always 0 or a power of 2 which is at least flat_group::width
+    uint64_t count; //!number of full slots
+    uint64_t deleted; //!number of tombstones
+    A alloc;
+
+    template <class Q>
+    static uint64_t slot_hash(const Q&);
+    static signed char fingerprint(uint64_t);
+    static uint64_t ctrl_bytes(uint64_t);
+    static uint64_t block_units(uint64_t);
+    void allocate(uint64_t);
+    void free_block(signed char*, uint64_t);
+    void release();
+    void copy_slots(const flat_bucket&);
+    template <class Q>
+    uint64_t lookup(const Q&) const; //!returns capacity when the key doesn't exist
+    uint64_t free_slot(uint64_t) const;
+    uint64_t insert_slot(uint64_t);
+    void regrow(uint64_t);
+    void erase_slot(uint64_t);
+    template <class Key, class... Args>
+    std::pair<iterator, bool> emplace_key(Key&&, Args&&...);
+};
+
+template <class K, class V, class H, class A>
+class flat_bucket<K,V,H,A>::iterator
+{
+public:
+    iterator(): slot(nullptr), state(nullptr), state_end(nullptr) {};
+    iterator(value_type*, const signed char*, const signed char*);
+    bool operator!=(const iterator& test) const {return slot != test.slot;}
+    bool operator==(const iterator& test) const {return slot == test.slot;}
+    value_type& operator*() const {return *slot;}
+    value_type* operator->() const {return slot;}
+    iterator& operator++();
+    iterator operator++(int);
+private:
+    value_type* slot;
+    const signed char* state;
+    const signed char* state_end;
+    void skip();
+    friend class const_iterator;
+    friend class flat_bucket<K,V,H,A>;
+};
+
+template <class K, class V, class H, class A>
+class flat_bucket<K,V,H,A>::const_iterator
+{
+public:
+    const_iterator(): slot(nullptr), state(nullptr), state_end(nullptr) {};
+    const_iterator(const value_type*, const signed char*, const signed char*);
+    const_iterator(const iterator&);
+    bool operator!=(const const_iterator& test) const {return slot != test.slot;}
+    bool operator==(const const_iterator& test) const {return slot == test.slot;}
+    const value_type& operator*() const {return *slot;}
+    const value_type* operator->() const {return slot;}
+    const_iterator& operator++();
+    const_iterator operator++(int);
+private:
+    const value_type* slot;
+    const signed char* state;
+    const signed char* state_end;
+    void skip();
+};
+
+//!node_type owns one key-value pair which was extracted from a flat_bucket.
+//!unlike the node handles of std::map the pair is moved into the node, so no memory is allocated or freed
+template <class K, class V, class H, class A>
+class flat_bucket<K,V,H,A>::node_type
+{
+public:
+    node_type(): full(false) {};
+    node_type(node_type&&);
+    node_type& operator=(node_type&&);
+    node_type(const node_type&) = delete;
+    node_type& operator=(const node_type&) = delete;
+    ~node_type();
+    bool empty() const {return !full;}
+    K& key() const {return const_cast<K&>(pair().first);}
+    V& mapped() const {return pair().second;}
+private:
+    alignas(value_type) unsigned char storage[sizeof(value_type)];
+    bool full;
+    value_type& pair() const {return *reinterpret_cast<value_type*>(const_cast<unsigned char*>(storage));}
+    void reset();
+    friend class flat_bucket<K,V,H,A>;
+};
+
+template <class K, class V, class H, class A>
+struct flat_bucket<K,V,H,A>::insert_return_type
+{
+    iterator position;
+    bool inserted;
+    node_type node;
+};
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::node_type::node_type(node_type&& input): full(input.full)
+{
+    if (full) {
+        new (storage) value_type(std::move(input.key()), std::move(input.mapped()));
+        input.reset();
+    }
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::node_type& flat_bucket<K,V,H,A>::node_type::operator=(node_type&& input)
+{
+    if (this != &input) {
+        reset();
+        if (input.full) {
+            new (storage) value_type(std::move(input.key()), std::move(input.mapped()));
+            full = true;
+            input.reset();
+        }
+    }
+    return *this;
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::node_type::~node_type()
+{
+    reset();
+}
+
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::node_type::reset()
+{
+    if (full) {
+        pair().~value_type();
+        full = false;
+    }
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::iterator::iterator(value_type* slot, const signed char* state, const signed char* state_end):
+    slot(slot), state(state), state_end(state_end)
+{
+    skip();
+}
+
+//!moves the iterator forward until it reaches a full slot or the end of the bucket
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::iterator::skip()
+{
+    while (state != state_end && *state < 0) {
+        ++state;
+        ++slot;
+    }
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::iterator& flat_bucket<K,V,H,A>::iterator::operator++()
+{
+    ++state;
+    ++slot;
+    skip();
+    return *this;
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::iterator flat_bucket<K,V,H,A>::iterator::operator++(int)
+{
+    iterator result(*this);
+    ++*this;
+    return result;
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::const_iterator::const_iterator(const value_type* slot, const signed char* state, const signed char* state_end):
+    slot(slot), state(state), state_end(state_end)
+{
+    skip();
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::const_iterator::const_iterator(const iterator& input):
+    slot(input.slot), state(input.state), state_end(input.state_end)
+{
+}
+
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::const_iterator::skip()
+{
+    while (state != state_end && *state < 0) {
+        ++state;
+        ++slot;
+    }
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::const_iterator& flat_bucket<K,V,H,A>::const_iterator::operator++()
+{
+    ++state;
+    ++slot;
+    skip();
+    return *this;
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::const_iterator flat_bucket<K,V,H,A>::const_iterator::operator++(int)
+{
+    const_iterator result(*this);
+    ++*this;
+    return result;
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::flat_bucket(): ctrl(nullptr), slots(nullptr), capacity(0), count(0), deleted(0)
+{
+    //!no memory is allocated until the first insert, kmap constructs a lot of empty buckets
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::flat_bucket(const A& input): ctrl(nullptr), slots(nullptr), capacity(0), count(0), deleted(0), alloc(input)
+{
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::flat_bucket(const flat_bucket& input): ctrl(nullptr), slots(nullptr), capacity(0), count(0), deleted(0),
+    alloc(alloc_traits::select_on_container_copy_construction(input.alloc))
+{
+    copy_slots(input);
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::flat_bucket(const flat_bucket& input, const A& other_alloc): ctrl(nullptr), slots(nullptr), capacity(0),
+    count(0), deleted(0), alloc(other_alloc)
+{
+    copy_slots(input);
+}
+
+//!the pairs are copied into the same slots so the probe sequences stay valid. the block of the bucket is kept when it
+//!has the capacity of input, otherwise it is replaced. when a copy throws the bucket is left empty
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::copy_slots(const flat_bucket& input)
+{
+    clear();
+    if (input.count == 0)
+        return;
+    if (capacity != input.capacity) {
+        release();
+        allocate(input.capacity);
+    }
+    try {
+        for (uint64_t i = 0; i < capacity; i++) {
+            if (input.ctrl[i] >= 0)
+                new (slots + i) value_type(input.slots[i]);
+            ctrl[i] = input.ctrl[i];
+        }
+    }
+    catch (...) {
+        release();
+        throw;
+    }
+    count = input.count;
+    deleted = input.deleted;
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::flat_bucket(flat_bucket&& input): ctrl(input.ctrl), slots(input.slots),
+    capacity(input.capacity), count(input.count), deleted(input.deleted), alloc(input.alloc)
+{
+    input.ctrl = nullptr;
+    input.slots = nullptr;
+    input.capacity = 0;
+    input.count = 0;
+    input.deleted = 0;
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>& flat_bucket<K,V,H,A>::operator=(const flat_bucket& input)
+{
+    if (this != &input) {
+        //!the block goes back to the allocator which gave it before the allocator of input replaces it
+        if (alloc_traits::propagate_on_container_copy_assignment::value) {
+            if (alloc != input.alloc)
+                release();
+            alloc = input.alloc;
+        }
+        copy_slots(input);
+    }
+    return *this;
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>& flat_bucket<K,V,H,A>::operator=(flat_bucket&& input)
+{
+    if (this != &input) {
+        release();
+        if (alloc_traits::propagate_on_container_move_assignment::value || alloc == input.alloc) {
+            if (alloc_traits::propagate_on_container_move_assignment::value)
+                alloc = input.alloc;
+            std::swap(ctrl, input.ctrl);
+            std::swap(slots, input.slots);
+            std::swap(capacity, input.capacity);
+            std::swap(count, input.count);
+            std::swap(deleted, input.deleted);
+        }
+        else {
+            //!the block belongs to another allocator, so the pairs are moved into a block of this one
+            allocate(input.capacity);
+            for (uint64_t i = 0; i < capacity; i++) {
+                if (input.ctrl[i] >= 0)
+                    new (slots + i) value_type(std::move(const_cast<K&>(input.slots[i].first)), std::move(input.slots[i].second));
+                ctrl[i] = input.ctrl[i];
+            }
+            count = input.count;
+            deleted = input.deleted;
+            input.release();
+        }
+    }
+    return *this;
+}
+
+template <class K, class V, class H, class A>
+flat_bucket<K,V,H,A>::~flat_bucket()
+{
+    release();
+}
+
+//!mixes the bits of the hash policy so that the slot inside the bucket does not depend
+//!on the same bits kmap used to pick the bucket
+template <class K, class V, class H, class A>
+template <class Q>
+uint64_t flat_bucket<K,V,H,A>::slot_hash(const Q& key)
+{
+    uint64_t h = H()(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+//!the top 7 bits of the hash, the low bits pick the group so the two are independent
+template <class K, class V, class H, class A>
+signed char flat_bucket<K,V,H,A>::fingerprint(uint64_t h)
+{
+    return static_cast<signed char>(h >> 57);
+}
+
+//!size of the control bytes rounded up so the slots that follow them are correctly aligned
+template <class K, class V, class H, class A>
+uint64_t flat_bucket<K,V,H,A>::ctrl_bytes(uint64_t size)
+{
+    const uint64_t align = alignof(value_type);
+    return (size + align - 1) / align * align;
+}
+
+//!allocates an empty block of the given capacity, the old block must already be released
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::allocate(uint64_t size)
+{
+    uint64_t offset = ctrl_bytes(size);
+    block_allocator blocks(alloc);
+    ctrl = reinterpret_cast<signed char*>(std::allocator_traits<block_allocator>::allocate(blocks, block_units(size)));
+    slots = reinterpret_cast<value_type*>(ctrl + offset);
+    for (uint64_t i = 0; i < size; i++)
+        ctrl[i] = flat_group::empty;
+    capacity = size;
+    count = 0;
+    deleted = 0;
+}
+
+//!number of std::max_align_t units in the block of a bucket with the given capacity
+template <class K, class V, class H, class A>
+uint64_t flat_bucket<K,V,H,A>::block_units(uint64_t size)
+{
+    uint64_t bytes = ctrl_bytes(size) + size * sizeof(value_type);
+    return (bytes + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+}
+
+//!gives a block of the given capacity back to the allocator
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::free_block(signed char* block, uint64_t size)
+{
+    if (block == nullptr)
+        return;
+    block_allocator blocks(alloc);
+    std::allocator_traits<block_allocator>::deallocate(blocks, reinterpret_cast<std::max_align_t*>(block), block_units(size));
+}
+
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::release()
+{
+    for (uint64_t i = 0; i < capacity; i++) {
+        if (ctrl[i] >= 0)
+            slots[i].~value_type();
+    }
+    free_block(ctrl, capacity);
+    ctrl = nullptr;
+    slots = nullptr;
+    capacity = 0;
+    count = 0;
+    deleted = 0;
+}
+
+//!groups are probed one after another starting at the group picked by the hash.
+//!a group with an empty slot ends the search because an insert would have used that slot.
+template <class K, class V, class H, class A>
+template <class Q>
+uint64_t flat_bucket<K,V,H,A>::lookup(const Q& key) const
+{
+    if (count == 0)
+        return capacity;
+    uint64_t h = slot_hash(key);
+    signed char tag = fingerprint(h);
+    uint64_t groups = capacity / flat_group::width;
+    uint64_t group = h & (groups - 1);
+    for (uint64_t probe = 0; probe < groups; probe++) {
+        uint64_t start = group * flat_group::width;
+        uint32_t mask = flat_group::match(ctrl + start, tag);
+        while (mask != 0) {
+            uint64_t i = start + flat_group::first(mask);
+            if (slots[i].first == key)
+                return i;
+            mask &= mask - 1;
+        }
+        if (flat_group::match_empty(ctrl + start) != 0)
+            return capacity;
+        group = (group + 1) & (groups - 1);
+    }
+    return capacity;
+}
+
+//!finds the first empty or deleted slot in the probe sequence of the hash
+//!the load factor always leaves an empty slot so the search always ends
+template <class K, class V, class H, class A>
+uint64_t flat_bucket<K,V,H,A>::free_slot(uint64_t h) const
+{
+    uint64_t groups = capacity / flat_group::width;
+    uint64_t group = h & (groups - 1);
+    while (true) {
+        uint64_t start = group * flat_group::width;
+        uint32_t mask = flat_group::match_free(ctrl + start);
+        if (mask != 0)
+            return start + flat_group::first(mask);
+        group = (group + 1) & (groups - 1);
+    }
+}
+
+//!moves every pair into a new block of the given size, dropping the tombstones
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::regrow(uint64_t size)
+{
+    signed char* old_ctrl = ctrl;
+    value_type* old_slots = slots;
+    uint64_t old_capacity = capacity;
+    uint64_t old_count = count;
+    allocate(size);
+    for (uint64_t j = 0; j < old_capacity; j++) {
+        if (old_ctrl[j] < 0)
+            continue;
+        uint64_t h = slot_hash(old_slots[j].first);
+        uint64_t i = free_slot(h);
+        //!the old pair is destroyed right after so its key can be moved from
+        new (slots + i) value_type(std::move(const_cast<K&>(old_slots[j].first)), std::move(old_slots[j].second));
+        ctrl[i] = fingerprint(h);
+        old_slots[j].~value_type();
+    }
+    count = old_count;
+    free_block(old_ctrl, old_capacity);
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::iterator flat_bucket<K,V,H,A>::find(const K& key)
+{
+    uint64_t i = lookup(key);
+    return iterator(slots + i, ctrl + i, ctrl + capacity);
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::const_iterator flat_bucket<K,V,H,A>::find(const K& key) const
+{
+    uint64_t i = lookup(key);
+    return const_iterator(slots + i, ctrl + i, ctrl + capacity);
+}
+
+template <class K, class V, class H, class A>
+template <class Q, class Hash, class>
+typename flat_bucket<K,V,H,A>::iterator flat_bucket<K,V,H,A>::find(const Q& key)
+{
+    uint64_t i = lookup(key);
+    return iterator(slots + i, ctrl + i, ctrl + capacity);
+}
+
+template <class K, class V, class H, class A>
+template <class Q, class Hash, class>
+typename flat_bucket<K,V,H,A>::const_iterator flat_bucket<K,V,H,A>::find(const Q& key) const
+{
+    uint64_t i = lookup(key);
+    return const_iterator(slots + i, ctrl + i, ctrl + capacity);
+}
+
+//!returns the value assigned to key, the key is inserted with a default value if it doesn't exist
+template <class K, class V, class H, class A>
+V& flat_bucket<K,V,H,A>::operator[](const K& key)
+{
+    return emplace_key(key).first->second;
+}
+
+template <class K, class V, class H, class A>
+template <class... Args>
+std::pair<typename flat_bucket<K,V,H,A>::iterator, bool> flat_bucket<K,V,H,A>::try_emplace(const K& key, Args&&... args)
+{
+    return emplace_key(key, std::forward<Args>(args)...);
+}
+
+template <class K, class V, class H, class A>
+template <class... Args>
+std::pair<typename flat_bucket<K,V,H,A>::iterator, bool> flat_bucket<K,V,H,A>::try_emplace(K&& key, Args&&... args)
+{
+    return emplace_key(std::move(key), std::forward<Args>(args)...);
+}
+
+template <class K, class V, class H, class A>
+template <class Key, class... Args>
+std::pair<typename flat_bucket<K,V,H,A>::iterator, bool> flat_bucket<K,V,H,A>::emplace_key(Key&& key, Args&&... args)
+{
+    uint64_t i = lookup(key);
+    if (i != capacity)
+        return std::pair<iterator, bool>(iterator(slots + i, ctrl + i, ctrl + capacity), false);
+    uint64_t h = slot_hash(key);
+    i = insert_slot(h);
+    new (slots + i) value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<Key>(key)),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+    ctrl[i] = fingerprint(h);
+    count += 1;
+    return std::pair<iterator, bool>(iterator(slots + i, ctrl + i, ctrl + capacity), true);
+}
+
+//!makes room for one more pair and returns the free slot it goes in, the caller constructs the pair and sets the control byte
+template <class K, class V, class H, class A>
+uint64_t flat_bucket<K,V,H,A>::insert_slot(uint64_t h)
+{
+    //!keep at most 7/8 of the slots in use (full or tombstone)
+    if ((count + deleted + 1) * 8 > capacity * 7) {
+        if (capacity == 0)
+            allocate(init_capacity);
+        else if (count * 2 < capacity)
+            regrow(capacity);//!mostly tombstones, reuse the same size
+        else
+            regrow(2 * capacity);
+    }
+    uint64_t i = free_slot(h);
+    if (ctrl[i] == flat_group::deleted)
+        deleted -= 1;
+    return i;
+}
+
+//!returns the number of keys erased (0 or 1)
+template <class K, class V, class H, class A>
+uint64_t flat_bucket<K,V,H,A>::erase(const K& key)
+{
+    uint64_t i = lookup(key);
+    if (i == capacity)
+        return 0;
+    slots[i].~value_type();
+    erase_slot(i);
+    return 1;
+}
+
+template <class K, class V, class H, class A>
+template <class Q, class Hash, class>
+uint64_t flat_bucket<K,V,H,A>::erase(const Q& key)
+{
+    uint64_t i = lookup(key);
+    if (i == capacity)
+        return 0;
+    slots[i].~value_type();
+    erase_slot(i);
+    return 1;
+}
+
+//!marks the slot at i as free after its pair was destroyed or moved out
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::erase_slot(uint64_t i)
+{
+    count -= 1;
+    //!every search reaching a group with an empty slot already stops at that group,
+    //!so the slot can go back to empty instead of becoming a tombstone
+    if (flat_group::match_empty(ctrl + i / flat_group::width * flat_group::width) != 0)
+        ctrl[i] = flat_group::empty;
+    else {
+        ctrl[i] = flat_group::deleted;
+        deleted += 1;
+    }
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::node_type flat_bucket<K,V,H,A>::extract(iterator position)
+{
+    node_type node;
+    uint64_t i = position.slot - slots;
+    //!the pair in the slot is destroyed right after so its key can be moved from
+    new (node.storage) value_type(std::move(const_cast<K&>(slots[i].first)), std::move(slots[i].second));
+    node.full = true;
+    slots[i].~value_type();
+    erase_slot(i);
+    return node;
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::insert_return_type flat_bucket<K,V,H,A>::insert(node_type&& node)
+{
+    insert_return_type result;
+    if (node.empty()) {
+        result.position = end();
+        result.inserted = false;
+        return result;
+    }
+    uint64_t i = lookup(node.key());
+    if (i != capacity) {
+        //!the key already exists, the node is handed back like std::map does
+        result.position = iterator(slots + i, ctrl + i, ctrl + capacity);
+        result.inserted = false;
+        result.node = std::move(node);
+        return result;
+    }
+    uint64_t h = slot_hash(node.key());
+    i = insert_slot(h);
+    new (slots + i) value_type(std::move(node.key()), std::move(node.mapped()));
+    ctrl[i] = fingerprint(h);
+    count += 1;
+    node.reset();
+    result.position = iterator(slots + i, ctrl + i, ctrl + capacity);
+    result.inserted = true;
+    return result;
+}
+
+//!removes all of the pairs but keeps the allocated slots
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::clear()
+{
+    for (uint64_t i = 0; i < capacity; i++) {
+        if (ctrl[i] >= 0)
+            slots[i].~value_type();
+        ctrl[i] = flat_group::empty;
+    }
+    count = 0;
+    deleted = 0;
+}
+
+template <class K, class V, class H, class A>
+void flat_bucket<K,V,H,A>::swap(flat_bucket& other)
+{
+    std::swap(ctrl, other.ctrl);
+    std::swap(slots, other.slots);
+    std::swap(capacity, other.capacity);
+    std::swap(count, other.count);
+    std::swap(deleted, other.deleted);
+    if (alloc_traits::propagate_on_container_swap::value) {
+        using std::swap;
+        swap(alloc, other.alloc);
+    }
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::iterator flat_bucket<K,V,H,A>::begin()
+{
+    return iterator(slots, ctrl, ctrl + capacity);
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::const_iterator flat_bucket<K,V,H,A>::begin() const
+{
+    return const_iterator(slots, ctrl, ctrl + capacity);
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::iterator flat_bucket<K,V,H,A>::end()
+{
+    return iterator(slots + capacity, ctrl + capacity, ctrl + capacity);
+}
+
+template <class K, class V, class H, class A>
+typename flat_bucket<K,V,H,A>::const_iterator flat_bucket<K,V,H,A>::end() const
+{
+    return const_iterator(slots + capacity, ctrl + capacity, ctrl + capacity);
+}
+
+template <class K, class V, class H, class A>
+bool flat_bucket<K,V,H,A>::empty() const
+{
+    return count == 0;
+}
+
+template <class K, class V, class H, class A>
+uint64_t flat_bucket<K,V,H,A>::size() const
+{
+    return count;
+}
+
+template <class K, class V, class H, class A>
+template <class Q>
+void flat_bucket<K,V,H,A>::prefetch(const Q& key) const
+{
+    if (capacity == 0)
+        return;
+    uint64_t start = (slot_hash(key) & (capacity / flat_group::width - 1)) * flat_group::width;
+    KMAP_PREFETCH(ctrl + start);
+    KMAP_PREFETCH(slots + start);
+}
+
+template <class K, class V, class H, class A>
+A flat_bucket<K,V,H,A>::get_allocator() const
+{
+    return alloc;
+}
+
+//!a flat_bucket only holds a pointer to its block, the counts and the allocator, so kvector can move it with memcpy
+template <class K, class V, class H, class A>
+struct kvector_relocatable<flat_bucket<K,V,H,A> > : std::true_type {};
+
+//!used by the batched lookups of kmap once the bucket itself is in the cache
+template <class K, class V, class H, class A, class Q>
+void kmap_prefetch(const flat_bucket<K,V,H,A>& bucket, const Q& key)
+{
+    bucket.prefetch(key);
+}
+
+//!bucket policy for kmap which stores every slot as a flat_bucket
+//!usage: kmap<K, V, default_kmap_hash<K>, fibonacci_index, flat_buckets>
+struct flat_buckets
+{
+    template <class K, class V, class Hash, class Alloc>
+    using bucket = flat_bucket<K,V,Hash,Alloc>;
+};
+
+#endif // FLAT_BUCKET_H_INCLUDED
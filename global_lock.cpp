@@ -1,6 +1,38 @@
 #include "global_lock.h"
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
 
-global_lock::global_lock()
+namespace
+{
+    //!tells the processor the thread is spinning, which frees the core for its other hyperthread
+    inline void cpu_pause()
+    {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    const unsigned max_backoff = 64; //pause instructions between two tries at most
+}
+
+lock_stats::lock_stats(): acquisitions(0), contended(0), spins(0), wait_ns(0)
+{
+}
+
+lock_stats& lock_stats::operator+=(const lock_stats& other)
+{
+    acquisitions += other.acquisitions;
+    contended += other.contended;
+    spins += other.spins;
+    wait_ns += other.wait_ns;
+    return *this;
+}
+
+global_lock::global_lock(): spin_limit(0), counting(false), statistics(nullptr)
 {
     //on construction global_lock is in a unlocked state
 }
@@ -9,19 +41,130 @@ global_lock::~global_lock()
 {
 	//lock.unlock(); //need to unlock the std::mutex to ensure
 	//the behavior is defined for the global lock object
+	delete statistics;
 }
 
 void global_lock::set_lock(bool setting)
 {
 	if (setting) {
-		lock.lock();
+		if (!lock.try_lock())
+			contended_lock();
+		else if (counting.load(std::memory_order_acquire))
+			statistics->acquisitions.fetch_add(1, std::memory_order_relaxed);
 	}
 	else {
 		lock.unlock();
 	}
 }
 
+//!spins with a doubling number of pause instructions between the tries until spin_limit is used up, then parks
+void global_lock::contended_lock()
+{
+	bool counted = counting.load(std::memory_order_acquire);
+	std::chrono::steady_clock::time_point start;
+	if (counted)
+		start = std::chrono::steady_clock::now();
+	uint64_t spun = 0;
+	unsigned delay = 1;
+	bool acquired = false;
+	while (spun < spin_limit) {
+		for (unsigned i = 0; i < delay; i++)
+			cpu_pause();
+		spun += delay;
+		if (lock.try_lock()) {
+			acquired = true;
+			break;
+		}
+		if (delay < max_backoff)
+			delay <<= 1;
+	}
+	if (!acquired)
+		lock.lock();
+	if (counted) {
+		uint64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		statistics->acquisitions.fetch_add(1, std::memory_order_relaxed);
+		statistics->contended.fetch_add(1, std::memory_order_relaxed);
+		statistics->spins.fetch_add(spun, std::memory_order_relaxed);
+		statistics->wait_ns.fetch_add(waited, std::memory_order_relaxed);
+	}
+}
+
 bool global_lock::try_lock()
+{
+	bool result = lock.try_lock();
+	if (result && counting.load(std::memory_order_acquire))
+		statistics->acquisitions.fetch_add(1, std::memory_order_relaxed);
+	return result;
+}
+
+void global_lock::set_spin(unsigned limit)
+{
+	spin_limit = limit;
+}
+
+//!the counters are made the first time and then kept, so a thread which just saw counting on can still use them
+void global_lock::count(bool setting)
+{
+	if (setting && statistics == nullptr) {
+		statistics = new counters();
+		reset_stats();
+	}
+	counting.store(setting, std::memory_order_release);
+}
+
+lock_stats global_lock::stats() const
+{
+	lock_stats result;
+	if (statistics != nullptr) {
+		result.acquisitions = statistics->acquisitions.load(std::memory_order_relaxed);
+		result.contended = statistics->contended.load(std::memory_order_relaxed);
+		result.spins = statistics->spins.load(std::memory_order_relaxed);
+		result.wait_ns = statistics->wait_ns.load(std::memory_order_relaxed);
+	}
+	return result;
+}
+
+void global_lock::reset_stats()
+{
+	if (statistics != nullptr) {
+		statistics->acquisitions.store(0, std::memory_order_relaxed);
+		statistics->contended.store(0, std::memory_order_relaxed);
+		statistics->spins.store(0, std::memory_order_relaxed);
+		statistics->wait_ns.store(0, std::memory_order_relaxed);
+	}
+}
+
+shared_global_lock::shared_global_lock()
+{
+    //on construction shared_global_lock is in a unlocked state
+}
+
+void shared_global_lock::set_lock(bool setting)
+{
+	if (setting) {
+		lock.lock();
+	}
+	else {
+		lock.unlock();
+	}
+}
+
+void shared_global_lock::set_shared(bool setting)
+{
+	if (setting) {
+		lock.lock_shared();
+	}
+	else {
+		lock.unlock_shared();
+	}
+}
+
+bool shared_global_lock::try_lock()
 {
 	return lock.try_lock();
 }
+
+bool shared_global_lock::try_shared()
+{
+	return lock.try_lock_shared();
+}
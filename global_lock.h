@@ -1,8 +1,25 @@
 #ifndef GLOBAL_LOCK_H
 #define GLOBAL_LOCK_H
 #include <mutex>
+#include <shared_mutex>
+#include <stdint.h>
+#include <atomic>
+
+//!contention statistics of a lock, wait_ns is the time spent waiting by the contended acquisitions
+struct lock_stats
+{
+    uint64_t acquisitions;
+    uint64_t contended; //acquisitions which found the lock held
+    uint64_t spins; //pause instructions executed before getting the lock
+    uint64_t wait_ns;
+    lock_stats();
+    lock_stats& operator+=(const lock_stats&);
+};
 
 //change this to use thread locks rather than booleans
+//!adaptive mode (set_spin): a thread which finds the lock held spins with pause instructions and a doubling
+//!backoff before it parks in the kernel, which pays off when the lock is only held for a few instructions.
+//!the statistics are only kept once count(true) was called, so a lock which isn't counted pays nothing for them
 class global_lock
 {
     public:
@@ -12,16 +29,138 @@ class global_lock
         bool try_lock();
         template <class T, class Function>
         void run_lock(T, Function);
+        //!the next two are called while no other thread uses the lock
+        void set_spin(unsigned); //pause instructions before parking, 0 (the default) parks at once
+        void count(bool); //turns the statistics on (keeping the old ones) or off
+        lock_stats stats() const;
+        void reset_stats();
     private:
+        struct counters
+        {
+            std::atomic<uint64_t> acquisitions;
+            std::atomic<uint64_t> contended;
+            std::atomic<uint64_t> spins;
+            std::atomic<uint64_t> wait_ns;
+        };
         std::mutex lock;
+        unsigned spin_limit;
+        std::atomic<bool> counting;
+        counters* statistics; //made by the first count(true) and kept until the lock is destroyed
+        void contended_lock();
 };
 
 template <class T, class Function>
 void global_lock::run_lock(T input, Function fn)
 {
-	lock.lock();
+	set_lock(true);
 	fn(input);
-	lock.unlock();
+	set_lock(false);
+}
+
+//!reader-writer version of global_lock: any number of threads can hold it shared at once,
+//!a thread holding it exclusively keeps every other thread out
+class shared_global_lock
+{
+    public:
+        shared_global_lock();
+        void set_lock(bool); //exclusive
+        void set_shared(bool);
+        bool try_lock();
+        bool try_shared();
+    private:
+        std::shared_mutex lock;
+};
+
+//!a fixed number of locks (global_lock or shared_global_lock) shared out between any number of slots,
+//!slot i uses stripe i modulo the number of stripes. every stripe has a cache line of its own so threads
+//!working on neighbouring slots don't slow each other down. the number of stripes is rounded up to a power of 2
+template <class Lock>
+class lock_stripes
+{
+    public:
+        explicit lock_stripes(uint64_t);
+        lock_stripes(const lock_stripes&) = delete;
+        lock_stripes& operator=(const lock_stripes&) = delete;
+        ~lock_stripes();
+        Lock& operator[](uint64_t); //lock of the slot
+        uint64_t size() const;
+        void set_all(bool); //exclusive, always in the same order
+        //!global_lock only: adaptive mode and statistics of every stripe, stats adds up the stripes
+        void set_spin(unsigned);
+        void count(bool);
+        lock_stats stats() const;
+        lock_stats stats(uint64_t) const; //statistics of one stripe (not slot), to find the hot ones
+    private:
+        struct alignas(64) stripe //64 bytes is the cache line of current x86 and ARM processors
+        {
+            Lock lock;
+        };
+        stripe* stripes;
+        uint64_t mask;
+};
+
+template <class Lock>
+lock_stripes<Lock>::lock_stripes(uint64_t count)
+{
+	uint64_t size = 1;
+	while (size < count)
+		size <<= 1;
+	stripes = new stripe[size];
+	mask = size - 1;
+}
+
+template <class Lock>
+lock_stripes<Lock>::~lock_stripes()
+{
+	delete[] stripes;
+}
+
+template <class Lock>
+Lock& lock_stripes<Lock>::operator[](uint64_t slot)
+{
+	return stripes[slot & mask].lock;
+}
+
+template <class Lock>
+uint64_t lock_stripes<Lock>::size() const
+{
+	return mask + 1;
+}
+
+template <class Lock>
+void lock_stripes<Lock>::set_all(bool setting)
+{
+	for (uint64_t i = 0; i <= mask; i++)
+		stripes[i].lock.set_lock(setting);
+}
+
+template <class Lock>
+void lock_stripes<Lock>::set_spin(unsigned limit)
+{
+	for (uint64_t i = 0; i <= mask; i++)
+		stripes[i].lock.set_spin(limit);
+}
+
+template <class Lock>
+void lock_stripes<Lock>::count(bool setting)
+{
+	for (uint64_t i = 0; i <= mask; i++)
+		stripes[i].lock.count(setting);
+}
+
+template <class Lock>
+lock_stats lock_stripes<Lock>::stats() const
+{
+	lock_stats result;
+	for (uint64_t i = 0; i <= mask; i++)
+		result += stripes[i].lock.stats();
+	return result;
+}
+
+template <class Lock>
+lock_stats lock_stripes<Lock>::stats(uint64_t stripe) const
+{
+	return stripes[stripe & mask].lock.stats();
 }
 
 #endif // GLOBAL_LOCK_H
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
+#include "hash_methods.h"
 using namespace std;
 
 int bitsize(int byte_size)
@@ -19,24 +21,7 @@ uint64_t hashing (unsigned long long key, size_t m, double a)
     return floor(m*(key*a-floor(key*a)));
 }
 
-//signed ints
-unsigned long long hashvalue(char c)
-{return fabs(c);}
-
-unsigned long long hashvalue(int c)
-{return fabs(c);}
-
-unsigned long long hashvalue(long c)
-{return fabs(c);}
-
-unsigned long long hashvalue(long long c)
-{return fabs(c);}
-
-//unsigned ints
-unsigned long long hashvalue(unsigned char c) {return c;}
-unsigned long long hashvalue(unsigned int c) {return c;}
-unsigned long long hashvalue(unsigned long long c) {return c;}
-unsigned long long hashvalue(unsigned long c) {return c;}
+const double fractional_index::a=geta();
 
 //floats
 unsigned long long hashvalue(float c)
@@ -75,14 +60,103 @@ unsigned long long hashvalue(long double c)
     }
 }
 
-unsigned long long const shift=6;
-unsigned long long const mask= ~0ULL <<
-    (bitsize(sizeof(unsigned long long))-shift);
+//the string and byte hashes read the key 8 bytes at a time in 4 independent lanes (32 bytes per step)
+//and finish with an avalanche so every input bit affects every output bit (same structure as XXH64).
+//the whole length is hashed, including embedded zero bytes.
+static unsigned long long const prime1=0x9E3779B185EBCA87ULL;
+static unsigned long long const prime2=0xC2B2AE3D27D4EB4FULL;
+static unsigned long long const prime3=0x165667B19E3779F9ULL;
+static unsigned long long const prime4=0x85EBCA77C2B2AE63ULL;
+static unsigned long long const prime5=0x27D4EB2F165667C5ULL;
 
-unsigned long long hashvalue(std::string const& c)
+static inline unsigned long long rotate_left(unsigned long long x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long read64(const unsigned char* p)
+{
+    unsigned long long result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+}
+
+static inline unsigned long long read32(const unsigned char* p)
+{
+    uint32_t result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+}
+
+static inline unsigned long long lane_round(unsigned long long lane, unsigned long long input)
+{
+    lane += input * prime2;
+    lane = rotate_left(lane, 31);
+    return lane * prime1;
+}
+
+static inline unsigned long long merge_lane(unsigned long long result, unsigned long long lane)
+{
+    result ^= lane_round(0, lane);
+    return result * prime1 + prime4;
+}
+
+unsigned long long hashbytes(const void* data, size_t size)
 {
-    unsigned long long result=0;
-    for(unsigned long long i=0; c[i]!=0; ++i)
-        result= (result & mask) ^ (result << shift) ^ c[i];
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    unsigned long long result;
+
+    if (size >= 32) {
+        unsigned long long v1 = prime1 + prime2;
+        unsigned long long v2 = prime2;
+        unsigned long long v3 = 0;
+        unsigned long long v4 = 0 - prime1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = lane_round(v1, read64(p));
+            v2 = lane_round(v2, read64(p + 8));
+            v3 = lane_round(v3, read64(p + 16));
+            v4 = lane_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        result = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+        result = merge_lane(result, v1);
+        result = merge_lane(result, v2);
+        result = merge_lane(result, v3);
+        result = merge_lane(result, v4);
+    }
+    else
+        result = prime5;
+
+    result += size;
+    //the remaining 0-31 bytes
+    while (p + 8 <= end) {
+        result ^= lane_round(0, read64(p));
+        result = rotate_left(result, 27) * prime1 + prime4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        result ^= read32(p) * prime1;
+        result = rotate_left(result, 23) * prime2 + prime3;
+        p += 4;
+    }
+    while (p < end) {
+        result ^= (*p) * prime5;
+        result = rotate_left(result, 11) * prime1;
+        p++;
+    }
+
+    //avalanche
+    result ^= result >> 33;
+    result *= prime2;
+    result ^= result >> 29;
+    result *= prime3;
+    result ^= result >> 32;
     return result;
 }
+
+unsigned long long hashvalue(std::string const& c)
+{
+    return hashbytes(c.data(), c.size());
+}
@@ -1,20 +1,27 @@
+#ifndef HASH_METHODS_H_INCLUDED
+#define HASH_METHODS_H_INCLUDED
+
 #include <string>
+#include <string_view>
 #include <stdint.h>
+#include <math.h>
+#include <type_traits>
 int bitsize(int);
 double geta();
 uint64_t hashing (unsigned long long , size_t, double);
 
+//the integer versions are defined here so they can be inlined into kmap
 //signed ints
-unsigned long long hashvalue(char);
-unsigned long long hashvalue(int);
-unsigned long long hashvalue(long long);
-unsigned long long hashvalue(long);
+inline unsigned long long hashvalue(char c) {return fabs(double(c));}
+inline unsigned long long hashvalue(int c) {return fabs(double(c));}
+inline unsigned long long hashvalue(long long c) {return fabs(double(c));}
+inline unsigned long long hashvalue(long c) {return fabs(double(c));}
 
 //unsigned ints
-unsigned long long hashvalue(unsigned char);
-unsigned long long hashvalue(unsigned int);
-unsigned long long hashvalue(unsigned long long);
-unsigned long long hashvalue(unsigned long);
+inline unsigned long long hashvalue(unsigned char c) {return c;}
+inline unsigned long long hashvalue(unsigned int c) {return c;}
+inline unsigned long long hashvalue(unsigned long long c) {return c;}
+inline unsigned long long hashvalue(unsigned long c) {return c;}
 
 //decimal values
 unsigned long long hashvalue(float);
@@ -23,3 +30,139 @@ unsigned long long hashvalue(long double);
 
 //c++ string
 unsigned long long hashvalue(std::string const&);
+
+//raw bytes, used for trivially copyable keys and strings (processes 32 bytes per step)
+unsigned long long hashbytes(const void*, size_t);
+
+//!hash policies turn a key into the unsigned long long used by the index policy (and by flat_bucket).
+//!kmap<K, V, Hash> calls Hash()(key), so any default constructible function object works.
+//!default_kmap_hash is used when no hash policy is given:
+//!signed integral keys are sign extended to 64 bits, so every bit of the key reaches the index policy and
+//!k and -k hash differently (fractional_index still places -k like the original kmap, see there), unsigned integral and floating point keys and
+//!std::string use the hashvalue overloads above, any other trivially copyable key (plain structs) hashes its
+//!bytes with hashbytes.
+//!note for structs with padding the padding bytes must be zeroed, otherwise equal keys can hash differently.
+//!other key types (for example std::tuple) need a specialization of default_kmap_hash or their own hash policy
+template <class K, class Enable = void>
+struct default_kmap_hash
+{
+    static_assert(std::is_trivially_copyable<K>::value,
+                  "kmap has no default hash for this key type, specialize default_kmap_hash or pass a hash policy to kmap");
+    unsigned long long operator()(const K& key) const
+    {
+        return hashbytes(&key, sizeof(K));
+    }
+};
+
+template <class K>
+struct default_kmap_hash<K, typename std::enable_if<std::is_integral<K>::value && std::is_signed<K>::value>::type>
+{
+    unsigned long long operator()(K key) const
+    {
+        return uint64_t(static_cast<long long>(key));
+    }
+};
+
+template <class K>
+struct default_kmap_hash<K, typename std::enable_if<(std::is_integral<K>::value && !std::is_signed<K>::value) ||
+                                                    std::is_floating_point<K>::value>::type>
+{
+    unsigned long long operator()(K key) const
+    {
+        return hashvalue(key);
+    }
+};
+
+//!the string hash is transparent: std::string_view and const char* keys hash to the same value as the
+//!std::string holding the same characters, so kmap can look them up without building a temporary std::string
+template <>
+struct default_kmap_hash<std::string>
+{
+    typedef void is_transparent;
+    unsigned long long operator()(const std::string& key) const
+    {
+        return hashvalue(key);
+    }
+    unsigned long long operator()(std::string_view key) const
+    {
+        return hashbytes(key.data(), key.size());
+    }
+    unsigned long long operator()(const char* key) const
+    {
+        return operator()(std::string_view(key));
+    }
+};
+
+//!true when the hash policy declares is_transparent, like the transparent comparators of the standard library.
+//!kmap and flat_bucket only accept lookups with a type other than the key when this is true
+template <class H, class Enable = void>
+struct is_transparent_hash : std::false_type {};
+
+template <class H>
+struct is_transparent_hash<H, typename std::conditional<false, typename H::is_transparent, void>::type> : std::true_type {};
+
+//!index policies turn the output of hashvalue into the index of the hash table used by kmap.
+//!table_size rounds a requested number of slots to a size the policy can work with
+//!and index maps a hash value to a slot in a table of that size.
+
+//!the original kmap hashing: floor(m*(key*a-floor(key*a))) with a = (sqrt(5)-1)/2
+//!works with any table size but is computed in double precision, so only keys below about 2^(53-log2(m))
+//!are spread over the table. hashes which use all 64 bits (strings, hashbytes) need fibonacci_index.
+//!a hash with the top bit set is a negative key (default_kmap_hash sign extends them), near 2^64 it would have
+//!no fraction left and land in bucket 0, so it is placed by its absolute value like the original hashvalue did
+struct fractional_index
+{
+    static const double a;
+    static uint64_t table_size(uint64_t size)
+    {
+        return size < 2 ? 2 : size;
+    }
+    static uint64_t index(unsigned long long key, uint64_t m)
+    {
+        if (key >> 63)
+            key = 0 - key;
+        return hashing(key, m, a);
+    }
+};
+
+//!fibonacci hashing: the key is multiplied by 2^64/phi and the top log2(m) bits are the index.
+//!uses every bit of the key and only integer operations but needs a power of 2 table size
+struct fibonacci_index
+{
+    static uint64_t table_size(uint64_t size)
+    {
+        uint64_t result = 2;
+        while (result < size)
+            result <<= 1;
+        return result;
+    }
+    static uint64_t index(unsigned long long key, uint64_t m)
+    {
+        return (uint64_t(key) * 11400714819323198485ULL) >> (64 - log2(m));
+    }
+    //!m is a power of 2
+    static unsigned log2(uint64_t m)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctzll(m);
+#else
+        unsigned result = 0;
+        while (m > 1) {
+            m >>= 1;
+            result++;
+        }
+        return result;
+#endif
+    }
+};
+
+//!false for the combinations kmap rejects at compile time: default_kmap_hash of a non-integral key (strings,
+//!floating point, structs) fills all 64 bits, which fractional_index packs into a few buckets.
+//!a hash policy of your own may be used with fractional_index as long as its values stay below 2^53
+template <class K, class H, class I>
+struct index_policy_fits : std::true_type {};
+
+template <class K>
+struct index_policy_fits<K, default_kmap_hash<K>, fractional_index> : std::is_integral<K> {};
+
+#endif // HASH_METHODS_H_INCLUDED
@@ -8,9 +8,25 @@
 #include <stdint.h>
 #include <map>
 #include <vector>
+#include <iterator>
 #include <stdexcept>
 #include <utility>
+#include <memory>
+#include <new>
+#include <thread>
+#include <exception>
+#include <atomic>
+#include <optional>
+#include <string>
+#include <algorithm>
 #include "global_lock.h"
+#include "flat_bucket.h"
+#include "kmap_alloc.h"
+#include "epoch.h"
+#include "work_pool.h"
+#include "bucket_bitmap.h"
+#include "kmap_image.h"
+#include "kmap_view.h"
 
 //*produce a const kmap iterator
 //after will need to add some more methods that are const
@@ -23,75 +39,120 @@
 
 //add protection to keep writing and reading separate when batching
 
-template<class K, class V>
+//!bucket policy which stores every slot of kmap as a std::map (the original layout)
+//!std::less<> lets the buckets of a kmap with a transparent hash be searched without converting the key
+struct map_buckets
+{
+    template <class K, class V, class Hash, class Alloc>
+    using bucket = std::map<K,V,std::less<>,Alloc>;
+};
+
+//!the batched lookups of kmap call kmap_prefetch once the bucket of a key is in the cache to prefetch the memory
+//!the lookup inside the bucket touches first. buckets without an overload (std::map) have nothing to prefetch
+template <class Bucket, class Q>
+void kmap_prefetch(const Bucket&, const Q&) {}
+
+template<class K, class V, class H = default_kmap_hash<K>, class I = fibonacci_index, class B = map_buckets,
+         class A = std::allocator<std::pair<const K, V> > >
 class kmap;//forward declaration
 
-template<class K, class V>
+template <class K, class V, class H, class I, class B, class A>
+class kmap_snapshot;
+
+template<class K, class V, class Bucket = std::map<K,V,std::less<> > >
 class kmap_iterator
 {
 private:
-	kvector_iterator<std::map<K,V> > index;
-	typename std::map<K,V>::iterator it;
-	kvector_iterator<std::map<K,V> > end;
-    friend class kmap<K,V>;
-    std::map<K,V>& map();
+	kvector_iterator<Bucket> index;
+	typename Bucket::iterator it;
+	kvector_iterator<Bucket> end;
+	//!set by kmap for the iterators over its table: operator++ finds the next bucket in the occupancy bitmap
+	//!instead of checking every bucket, nullptr makes it check them one by one
+	const std::atomic<uint64_t>* occupied;
+	Bucket* table; //first bucket
+	uint64_t position; //number of the bucket of index
+	//!also set by kmap for the iterators over its table: operator* and operator-> hand out a pair which can be
+	//!changed, so they announce its bucket and key to the map first (see kmap::snapshot and kmap::checkpoint)
+	void (*announce)(void*, uint64_t, const K&);
+	void* owner;
+    template <class, class, class, class, class, class> friend class kmap;
+    Bucket& map();
 public:
-    kmap_iterator() {};
-    kmap_iterator(kvector_iterator<std::map<K,V> >);
-    kmap_iterator(kvector_iterator<std::map<K,V> >, typename std::map<K,V>::iterator, kvector_iterator<std::map<K,V> >);
+    kmap_iterator(): occupied(nullptr), announce(nullptr) {};
+    kmap_iterator(kvector_iterator<Bucket>);
+    kmap_iterator(kvector_iterator<Bucket>, typename Bucket::iterator, kvector_iterator<Bucket>);
 	bool operator!=(const kmap_iterator&);
 	std::pair<const K, V>& operator*();
-	typename std::map<K,V>::iterator& operator->();
+	typename Bucket::iterator& operator->();
     kmap_iterator& operator++();
     kmap_iterator operator++(int);
     bool in_map();
 };
 
-template<class K, class V>
-kmap_iterator<K,V>::kmap_iterator(kvector_iterator<std::map<K,V> > index)
+template<class K, class V, class Bucket>
+kmap_iterator<K,V,Bucket>::kmap_iterator(kvector_iterator<Bucket> index)
 {
     this->index = index;
+    this->occupied = nullptr;
+    this->announce = nullptr;
 }
 
-template<class K, class V>
-kmap_iterator<K,V>::kmap_iterator(kvector_iterator<std::map<K,V> > index, typename std::map<K,V>::iterator it, kvector_iterator<std::map<K,V> > end)
+template<class K, class V, class Bucket>
+kmap_iterator<K,V,Bucket>::kmap_iterator(kvector_iterator<Bucket> index, typename Bucket::iterator it, kvector_iterator<Bucket> end)
 {
     this->index = index;
     this->it = it;
     this->end = end;
+    this->occupied = nullptr;
+    this->announce = nullptr;
 }
 
-template<class K, class V>
-bool kmap_iterator<K,V>::operator!=(const kmap_iterator<K,V>& test)
+template<class K, class V, class Bucket>
+bool kmap_iterator<K,V,Bucket>::operator!=(const kmap_iterator<K,V,Bucket>& test)
 {
 	return this->index != test.index;
 }
 
-template<class K, class V>
-std::map<K,V>& kmap_iterator<K,V>::map()
+template<class K, class V, class Bucket>
+Bucket& kmap_iterator<K,V,Bucket>::map()
 {
     return *index;
 }
 
-template<class K, class V>
-std::pair<const K, V>& kmap_iterator<K,V>::operator*()
+template<class K, class V, class Bucket>
+std::pair<const K, V>& kmap_iterator<K,V,Bucket>::operator*()
 {
+    if (announce != nullptr)
+        announce(owner, position, it->first);
     return *it;
 }
 
-template<class K, class V>
-typename std::map<K,V>::iterator& kmap_iterator<K,V>::operator->()
+template<class K, class V, class Bucket>
+typename Bucket::iterator& kmap_iterator<K,V,Bucket>::operator->()
 {
+    if (announce != nullptr)
+        announce(owner, position, it->first);
     return it;
 }
 
-template<class K, class V>
-kmap_iterator<K,V>& kmap_iterator<K,V>::operator++()
+template<class K, class V, class Bucket>
+kmap_iterator<K,V,Bucket>& kmap_iterator<K,V,Bucket>::operator++()
 {
     ++it;
     if (it != map().end()) {
         return *this;
     }
+    else if (occupied != nullptr) {
+        //!a marked bucket can still be empty, the end marker of the bitmap gives the end of the table
+        do {
+            position = bucket_bitmap::next(occupied, position + 1);
+            index = kvector_iterator<Bucket>(table + position);
+            if (index == end)
+                return *this;
+        } while (map().empty());
+        it = map().begin();
+        return *this;
+    }
     else {
 		//finding the correct index for key_position
         ++index;
@@ -109,80 +170,95 @@ kmap_iterator<K,V>& kmap_iterator<K,V>::operator++()
     }
 }
 
-template<class K, class V>
-kmap_iterator<K,V> kmap_iterator<K,V>::operator++(int)
+template<class K, class V, class Bucket>
+kmap_iterator<K,V,Bucket> kmap_iterator<K,V,Bucket>::operator++(int)
 {
-    kmap_iterator<K,V> result(*this);
+    kmap_iterator<K,V,Bucket> result(*this);
     ++*this;
     return result;
 }
 
-template<class K, class V>
-bool kmap_iterator<K,V>::in_map()
+template<class K, class V, class Bucket>
+bool kmap_iterator<K,V,Bucket>::in_map()
 {
     return it != map().end();
 }
 
-template<class K, class V>
+template<class K, class V, class Bucket = std::map<K,V,std::less<> > >
 class const_kmap_iterator
 {
 private:
-    const_kvector_iterator<std::map<K,V> > index;
-    typename std::map<K,V>::const_iterator it;
-    const_kvector_iterator<std::map<K,V> > end;
-    friend class kmap<K,V>;
-    const std::map<K,V>& map();
+    const_kvector_iterator<Bucket> index;
+    typename Bucket::const_iterator it;
+    const_kvector_iterator<Bucket> end;
+    const std::atomic<uint64_t>* occupied; //see kmap_iterator
+    const Bucket* table;
+    uint64_t position;
+    template <class, class, class, class, class, class> friend class kmap;
+    const Bucket& map();
 public:
-    const_kmap_iterator() {};
-    const_kmap_iterator(const_kvector_iterator<std::map<K,V> >);
-    const_kmap_iterator(const_kvector_iterator<std::map<K,V> >, typename std::map<K,V>::const_iterator, const_kvector_iterator<std::map<K,V> >);
+    const_kmap_iterator(): occupied(nullptr) {};
+    const_kmap_iterator(const_kvector_iterator<Bucket>);
+    const_kmap_iterator(const_kvector_iterator<Bucket>, typename Bucket::const_iterator, const_kvector_iterator<Bucket>);
     bool operator!=(const const_kmap_iterator&);
     const std::pair<const K, V>& operator*();
-    typename std::map<K,V>::const_iterator& operator->();
+    typename Bucket::const_iterator& operator->();
     const_kmap_iterator& operator++();
     const_kmap_iterator operator++(int);
     bool in_map();
 };
 
-template<class K, class V>
-const_kmap_iterator<K,V>::const_kmap_iterator(const_kvector_iterator<std::map<K,V> > index)
+template<class K, class V, class Bucket>
+const_kmap_iterator<K,V,Bucket>::const_kmap_iterator(const_kvector_iterator<Bucket> index)
 {
 	this->index = index;
+	this->occupied = nullptr;
 }
 
-template<class K, class V>
-const_kmap_iterator<K,V>::const_kmap_iterator(const_kvector_iterator<std::map<K,V> > index, typename std::map<K,V>::const_iterator, const_kvector_iterator<std::map<K,V> > end)
+template<class K, class V, class Bucket>
+const_kmap_iterator<K,V,Bucket>::const_kmap_iterator(const_kvector_iterator<Bucket> index, typename Bucket::const_iterator it, const_kvector_iterator<Bucket> end)
 {
 	this->index = index;
 	this->it = it;
 	this->end = end;
+	this->occupied = nullptr;
 }
 
-template<class K, class V>
-bool const_kmap_iterator<K,V>::operator !=(const const_kmap_iterator &test)
+template<class K, class V, class Bucket>
+bool const_kmap_iterator<K,V,Bucket>::operator !=(const const_kmap_iterator &test)
 {
 	return this->index != test.index;
 }
 
-template<class K, class V>
-const std::pair<const K,V>& const_kmap_iterator<K,V>::operator *()
+template<class K, class V, class Bucket>
+const std::pair<const K,V>& const_kmap_iterator<K,V,Bucket>::operator *()
 {
 	return *it;
 }
 
-template<class K, class V>
-typename std::map<K,V>::const_iterator& const_kmap_iterator<K,V>::operator ->()
+template<class K, class V, class Bucket>
+typename Bucket::const_iterator& const_kmap_iterator<K,V,Bucket>::operator ->()
 {
 	return it;
 }
 
-template<class K, class V>
-const_kmap_iterator<K,V>& const_kmap_iterator<K,V>::operator ++()
+template<class K, class V, class Bucket>
+const_kmap_iterator<K,V,Bucket>& const_kmap_iterator<K,V,Bucket>::operator ++()
 {
     ++it;
     if (it != map().end()) {
         return *this;
     }
+    else if (occupied != nullptr) {
+        do {
+            position = bucket_bitmap::next(occupied, position + 1);
+            index = const_kvector_iterator<Bucket>(table + position);
+            if (index == end)
+                return *this;
+        } while (map().empty());
+        it = map().begin();
+        return *this;
+    }
     else {
 		//finding the correct index for key_position
         ++index;
@@ -200,43 +276,84 @@ const_kmap_iterator<K,V>& const_kmap_iterator<K,V>::operator ++()
     }
 }
 
-template<class K, class V>
-const_kmap_iterator<K,V> const_kmap_iterator<K,V>::operator ++(int)
+template<class K, class V, class Bucket>
+const_kmap_iterator<K,V,Bucket> const_kmap_iterator<K,V,Bucket>::operator ++(int)
 {
-    const_kmap_iterator<K,V> result(*this);
+    const_kmap_iterator<K,V,Bucket> result(*this);
     ++*this;
     return result;
 }
 
-template<class K, class V>
-bool const_kmap_iterator<K,V>::in_map()
+template<class K, class V, class Bucket>
+bool const_kmap_iterator<K,V,Bucket>::in_map()
 {
 	return it != map().end();
 }
 
-template<class K, class V>
-const std::map<K,V>& const_kmap_iterator<K,V>::map()
+template<class K, class V, class Bucket>
+const Bucket& const_kmap_iterator<K,V,Bucket>::map()
 {
 	return *index;
 }
 
-template<class K, class V>
+template<class K, class V, class H, class I, class B, class A>
 class kmap
 {
 public:
+    //!the hash policy H turns a key into the value given to the index policy (see default_kmap_hash)
+    //!the index policy I (fibonacci_index by default or fractional_index) picks the slot of a key and the allowed table sizes,
+    //!fractional_index needs an integral key or a hash of your own below 2^53 (see index_policy_fits)
+    //!type stored in every slot of the hash table, chosen by the bucket policy B (map_buckets or flat_buckets)
+    //!the allocator A is given to every bucket, so the std::map nodes or the flat_bucket blocks come from it.
+    //!kmap_arena_allocator and kmap_pool_allocator (kmap_alloc.h) take the memory from a resource which
+    //!clear() and clean() release in one step
+    typedef typename B::template bucket<K,V,H,A> bucket_type;
+    typedef A allocator_type;
+    typedef kmap_iterator<K,V,bucket_type> iterator;
+    typedef const_kmap_iterator<K,V,bucket_type> const_iterator;
+    static_assert(index_policy_fits<K,H,I>::value,
+                  "fractional_index only spreads hashes below 2^53, use fibonacci_index for keys which aren't integral");
+    //!enables the heterogeneous overloads of find, at, remove and operator[] for a lookup type Q,
+    //!only when the hash policy is transparent (see is_transparent_hash) and Q isn't K itself
+    template <class Q>
+    using transparent_key = typename std::enable_if<is_transparent_hash<H>::value &&
+                                                    !std::is_same<typename std::decay<Q>::type, K>::value>::type;
+
     kmap();
     kmap(uint64_t);
+    explicit kmap(const A&);
+    kmap(uint64_t, const A&);
     kmap(const kmap&);
-    kmap<K,V>& operator=(const kmap&);
+    kmap<K,V,H,I,B,A>& operator=(const kmap&);
     kmap(kmap&&);
-    kmap<K,V>& operator=(kmap&&);
+    kmap<K,V,H,I,B,A>& operator=(kmap&&);
     ~kmap();
 
     //!beginning of methods used to manage kmap [inserting keys, clearing/cleaning, resizing, and swapping]
     void clear();
     void clean();
     void insert(const K&, const V&);
+    void insert(K&&, V&&); //!moves the key and the value into the map
     V& operator[](const K&); //!can be used for inserting, changing and finding the value;
+    V& operator[](K&&);
+    //!the next methods report where the key is and whether it was inserted (true) or already there (false).
+    //!in read-write mode they work on the write storage like insert does, so true means new to the write storage
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args&&...); //!builds the key-value pair from the arguments
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K&, Args&&...); //!the value is only built when the key is new
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K&&, Args&&...);
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(const K&, M&&); //!assigns the value when the key already exists
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(K&&, M&&);
+    //!bulk loading: inserts every key-value pair of [first, last) like insert does (a later duplicate replaces the value).
+    //!the map is presized once for the whole input, all of the keys are hashed in one pass, grouped by bucket
+    //!with a counting sort and then every bucket is filled in one go. the last parameter is the number of threads
+    //!used for hashing and filling (1 by default). move iterators move the pairs into the map
+    template <class InputIt>
+    void insert_range(InputIt, InputIt, unsigned = 1);
     void resize(uint64_t); //!triggers a rehashing
     //!note unlike the vector version this will do absolutely nothing
     //!if the inputed size is less than the current capacity of the vector
@@ -245,346 +362,1218 @@ public:
 
     //!begining of methods used for finding, getting and setting keys/values
     //!note you cant set the key because that would possibly destroy the map
-    kmap_iterator<K,V> find(const K&);
-    const_kmap_iterator<K,V> find(const K&) const;
+    iterator find(const K&);
+    const_iterator find(const K&) const;
     V& at(const K&);
     const V& at(const K&) const;
     void remove(const K&);
+    //!heterogeneous versions: with the default string hash a std::string_view or const char* finds the
+    //!std::string key holding the same characters without building a temporary std::string.
+    //!operator[] only builds the key when it has to be inserted
+    template <class Q, class = transparent_key<Q> >
+    iterator find(const Q&);
+    template <class Q, class = transparent_key<Q> >
+    const_iterator find(const Q&) const;
+    template <class Q, class = transparent_key<Q> >
+    V& at(const Q&);
+    template <class Q, class = transparent_key<Q> >
+    const V& at(const Q&) const;
+    template <class Q, class = transparent_key<Q> >
+    void remove(const Q&);
+    template <class Q, class = transparent_key<Q> >
+    V& operator[](const Q&);
+    //!batched lookups of n keys: out[i] is the result for keys[i], the same as find(keys[i]) would give.
+    //!all of the keys of a window are hashed and their buckets prefetched before the first one is searched,
+    //!so the cache misses of the keys overlap instead of following one another
+    void find_batch(const K*, uint64_t, iterator*);
+    void find_batch(const K*, uint64_t, const_iterator*) const;
+    void contains_batch(const K*, uint64_t, bool*) const;
     //!end of methods used for finding, getting and setting keys/values
 
     //!beginning of methods used for iteration through the map
-    kmap_iterator<K,V> begin();
-    const_kmap_iterator<K,V> begin() const;
-    kmap_iterator<K,V> end();
-    const_kmap_iterator<K,V> end() const;
+    iterator begin();
+    const_iterator begin() const;
+    iterator end();
+    const_iterator end() const;
     uint64_t hash_size() const;
-    std::map<K,V>& batch(uint64_t);
-    const std::map<K,V>& batch(uint64_t) const;
+    bucket_type& batch(uint64_t);
+    const bucket_type& batch(uint64_t) const;
+    //!parallel iteration: fn is called once with every key-value pair (the mutable version can change the values).
+    //!the buckets are cut into ranges holding about the same number of pairs, ranges_per_thread ranges per thread,
+    //!and the threads of the work_pool (work_pool::standard() by default) share them out by work stealing.
+    //!the map may not be changed meanwhile and must not be in concurrent mode
+    template <class Function>
+    void parallel_for_each(Function);
+    template <class Function>
+    void parallel_for_each(Function, work_pool&);
+    template <class Function>
+    void parallel_for_each(Function) const;
+    template <class Function>
+    void parallel_for_each(Function, work_pool&) const;
+    //!reduce(init, transform(pair) ...) over every key-value pair like std::transform_reduce, reduce has to be
+    //!associative. every range is reduced on its own and the results are combined with init in bucket order
+    template <class T, class Reduce, class Transform>
+    T parallel_reduce(T, Reduce, Transform);
+    template <class T, class Reduce, class Transform>
+    T parallel_reduce(T, Reduce, Transform, work_pool&);
+    template <class T, class Reduce, class Transform>
+    T parallel_reduce(T, Reduce, Transform) const;
+    template <class T, class Reduce, class Transform>
+    T parallel_reduce(T, Reduce, Transform, work_pool&) const;
+    static const uint64_t ranges_per_thread;
+    //!splittable iteration: n ranges [first, second) of iterators in iteration order, covering disjoint runs of
+    //!buckets which hold about the same number of pairs (balanced like parallel_for_each). together they visit
+    //!every pair once, so each range can be walked by a thread of its own, e.g. with
+    //!std::for_each(std::execution::par, ...) over the vector. a range is empty (first == second) when the pairs
+    //!run out before it or a single bucket outweighs it. the map may not be changed while the ranges are used
+    std::vector<std::pair<iterator, iterator> > ranges(uint64_t);
+    std::vector<std::pair<const_iterator, const_iterator> > ranges(uint64_t) const;
     //!end of methods used for iteration through the map
 
     bool empty() const;
     uint64_t entry_number() const;
+    A get_allocator() const;
     //!parameter which controls maximum number of entries
-    static const uint64_t map_size;//estimated maximum in each std::map
+    static const uint64_t map_size;//estimated maximum in each bucket
+    //!parameters of the batched lookups
+    static const uint64_t batch_window;//keys hashed and prefetched at once
+    static const uint64_t prefetch_distance;//keys between prefetching inside a bucket and searching it
     //!note:this is public in case the user needs to resize the map based on the size of the required vector
     //!take the size of the vector (which can be gotten from using the hash_size method) then
     //!multiply by kmap<T>::map_size
     //!if sizing the map to the number of entries use entry number instead
     void begin_read_write(bool);
-    void end_read_write(bool);
+    //!true moves the write storage buckets over the buckets of values, false merges the write storage into values.
+    //!the second parameter is the number of threads (1 by default), each of them owns a range of buckets.
+    //!the map rehashes at most once: before merging, sized as if every pending pair were new, or after moving
+    void end_read_write(bool, unsigned = 1);
     bool move_write_batch(uint64_t);
+    //!number of locks used by begin_read_write(true) and concurrent mode (default_stripes by default), every lock
+    //!guards the buckets whose index is the same modulo that number. it is rounded up to a power of 2, never more
+    //!than the number of buckets, and takes effect the next time the write storage or concurrent mode begins
+    void stripe_count(uint64_t);
+    static const uint64_t default_stripes;
+    //!the locks of begin_read_write(true) are adaptive: a writer finding its bucket locked spins this many pause
+    //!instructions (default_lock_spin by default, 0 parks at once) before it parks, since the writes are short
+    void lock_spin_limit(unsigned);
+    static const unsigned default_lock_spin;
+    //!contention statistics of the write storage locks, kept from the next begin_read_write(true) on.
+    //!lock_statistics adds up every write phase counted so far with the running one, the version taking
+    //!a stripe gives that stripe of the running phase to find the hot spots
+    void count_locks(bool);
+    lock_stats lock_statistics() const;
+    lock_stats lock_statistics(uint64_t) const;
+
+    //!incremental rehashing spreads the rehash that follows growth over the next operations
+    //!instead of rehashing the whole map inside the insert that triggered the growth.
+    //!the input is the number of old buckets migrated by every insert, find and remove (0 turns it off, the default)
+    void incremental_rehash(uint64_t);
+    bool rehashing() const; //!true while buckets hashed with the old size are still waiting to be migrated
+    void finish_rehash(); //!migrates all of the remaining buckets
+
+    //!number of threads used by resize and by the rehash that follows growth (1 by default)
+    //!the result is the same as the rehash done by a single thread
+    void rehash_threads(unsigned);
+
+    //!concurrent mode: find, at, operator[], insert, emplace, try_emplace, insert_or_assign, insert_range, remove,
+    //!visit and the batched lookups can be called by many threads at once, straight on the map.
+    //!lookups hold a shared lock and inserts/removes an exclusive lock of the key's bucket, growth holds all of them.
+    //!the locks are striped over the buckets the table has when concurrent mode begins, so presize with resize first.
+    //!the lock is released before the call returns: the pairs reached through the iterators and references
+    //!can be changed by other threads (with flat_buckets moved by any insert into their bucket), so a returned iterator
+    //!shouldn't be compared or checked with in_map. visit and contains_batch test and read keys under the lock.
+    //!every other method needs the concurrent calls to have stopped.
+    //!with lock free reads (true) every bucket is an immutable version which writers replace with an edited copy,
+    //!visit and contains_batch then read without taking any lock and the replaced versions are freed through an
+    //!epoch_domain (epoch.h) once no reader can reach them. writes copy the whole bucket, so this suits maps which are
+    //!mostly read. no references can be handed out: find, at, operator[] and find_batch throw std::logic_error,
+    //!the inserts return end() and iteration needs end_concurrent first
+    void begin_concurrent(bool = false);
+    void end_concurrent();
+    bool concurrent() const;
+    bool lock_free_reads() const;
+    template <class Function>
+    bool visit(const K&, Function) const; //!calls the function with the value of the key if it exists
+
+    //!copy on write snapshots: snapshot() hands out a read-only view of the pairs of values as they are now without
+    //!copying any pair (it costs a null pointer per bucket). the view shares the buckets with the map and the first
+    //!change of a bucket after the snapshot copies the bucket into the view, so the memory of a view grows with the
+    //!buckets changed since it was taken. the changes are the inserts of a new key, the removes of a key which is
+    //!there, insert_or_assign, insert_range, move_write_batch and end_read_write. the pairs reached through a non-const
+    //!iterator (of find, find_batch, begin, ranges or an insert finding its key) can be changed, so operator* and
+    //!operator-> of the iterator count as a change of its bucket, while finding, in_map and moving on don't.
+    //!at and operator[] hand out the value and batch the bucket, so they count as a change when they find it, and
+    //!the non-const parallel_for_each and parallel_reduce count every bucket holding pairs (read through a const
+    //!reference of the map to share the buckets). growth, resize, clear, clean, assignment and lock free concurrent
+    //!mode change the whole table, so they first copy every bucket the views still share.
+    //!any number of threads can read a view while the map is written to (by one thread, or by many in concurrent mode)
+    //!and a view stays valid after the map is gone. snapshot() needs the writers to have stopped unless the map
+    //!is in concurrent mode, there at, operator[] and operator* and operator-> of the iterators take the exclusive
+    //!lock of a bucket a view still shares, and
+    //!the values reached through references handed out before the snapshot have to be left alone until it is taken.
+    //!it throws std::logic_error while the reads are lock free or if V can't be copied.
+    //!the pairs waiting in the write storage aren't part of the view
+    typedef kmap_snapshot<K,V,H,I,B,A> snapshot_type;
+    snapshot_type snapshot();
+
+    //!writes a binary image of the map to the file (see kmap_image.h), which kmap_view::open (kmap_view.h) maps
+    //!and searches in place. the keys and values have to be trivially copyable or std::string
+    //!(or have a kmap_image_codec). the image is written next to the file and then replaces it, errors throw
+    //!std::runtime_error. the map can't be in concurrent mode (std::logic_error) and the pairs waiting in the
+    //!write storage aren't saved
+    void save(const std::string&) const;
+
+    //!incremental checkpoints: every change of a bucket (as listed at snapshot()) marks it dirty and checkpoint
+    //!appends the dirty buckets to a log file as one record, which is on the disk once it returns. the first
+    //!checkpoint and the first one after the table was changed as a whole (growth, resize, clear, clean, assignment)
+    //!write every bucket, a checkpoint without changes writes nothing.
+    //!compact saves the map as the new base image (see save) and empties the log, so the log stays short.
+    //!recover rebuilds the map of the last checkpoint from the base image and the log, with the same table size and
+    //!the same pairs in every bucket. either file may be missing, a record which was cut short (the machine stopped
+    //!while it was written) ends the log. the pairs are encoded like save does, the map can't be in concurrent mode
+    //!(std::logic_error) and the pairs waiting in the write storage aren't written. errors of the files throw
+    //!std::runtime_error, recover leaves the map empty then
+    void checkpoint(const std::string&); //!the log
+    void compact(const std::string&, const std::string&); //!the base image and the log
+    void recover(const std::string&, const std::string&); //!the base image and the log, needs no write storage
 private:
+    //!the pairs are spliced between buckets, so every bucket is built with an allocator equal to alloc
+    A alloc;
 	uint64_t entries;
-    kvector<std::map<K,V> > values;
+    kvector<bucket_type> values;
+    //!the buckets which may hold pairs: every insert marks its bucket and a remove which empties it clears it
+    bucket_bitmap occupied;
+    //!parameters of the checkpoints
+    bucket_bitmap dirty; //buckets changed since the last checkpoint, only kept up while all_dirty is false
+    bool all_dirty; //the whole table has to go into the next checkpoint (none was made yet or the table was replaced)
+    uint64_t checkpoints; //sequence number of the last checkpoint
     //!parameter which controls maximum number of entries
     uint64_t kmap_size;//absolute maximum in kmap before rehash
     //!parameters which work with the hashing function
-    static const double a;
     uint64_t m; //capacity of the vector
+    //!parameters for incremental rehashing
+    uint64_t rehash_step; //number of old buckets migrated per operation, 0 when incremental rehashing is off
+    uint64_t old_m; //capacity of the vector before the last growth, 0 when no migration is running
+    uint64_t migrated; //old buckets below this index have been migrated
+    unsigned workers; //number of threads used for a full rehash
+    uint64_t stripes; //number of lock stripes of the write storage and concurrent mode
+    unsigned lock_spin; //pause instructions of the write storage locks before parking
+    bool lock_counting; //whether the write storage locks keep statistics
+    lock_stats lock_history; //statistics of the write storages which have ended
     void init_hash_props();
+    static kvector<bucket_type> make_table(uint64_t, const A&);
+    static kvector<bucket_type> copy_table(const kvector<bucket_type>&, const A&);
+    template <class Q>
+    static uint64_t bucket_index(const Q&, uint64_t);
+    //!shared bodies of the K and the heterogeneous lookups
+    template <class Q>
+    iterator find_key(const Q&);
+    template <class Q>
+    const_iterator find_key(const Q&) const;
+    template <class Q>
+    V& at_key(const Q&);
+    template <class Q>
+    const V& at_key(const Q&) const;
+    template <class Q>
+    void remove_key(const Q&);
+    template <class Q>
+    V& subscript(const Q&);
+    template <class Resolve>
+    void lookup_batch(const K*, uint64_t, Resolve) const;
+    static const K& materialize(const K& key) {return key;}
+    template <class Q>
+    static K materialize(const Q& key) {return K(key);}
     void rehash(uint64_t);
+    void rehash_bucket(uint64_t);
+    void parallel_rehash(uint64_t);
+    template <class Function>
+    static void run_parallel(unsigned, Function);
+    std::vector<uint64_t> balanced_ranges(uint64_t) const;
+    static uint64_t pool_ranges(const work_pool&);
+    iterator bucket_begin(uint64_t);
+    const_iterator bucket_begin(uint64_t) const;
+    uint64_t next_bucket(uint64_t) const;
+    iterator iterator_at(uint64_t, typename bucket_type::iterator);
+    const_iterator iterator_at(uint64_t, typename bucket_type::const_iterator) const;
+    void track(uint64_t);
+    void track_table();
+    template <class Table, class Function>
+    static void for_each_pair(Table&, Function, work_pool&, const std::vector<uint64_t>&, kmap*);
+    template <class Table, class T, class Reduce, class Transform>
+    static T reduce_pairs(Table&, T, Reduce, Transform, work_pool&, const std::vector<uint64_t>&, kmap*);
+    void grow();
+    void migrate_step();
     struct write_storage
     {
-    	write_storage(uint64_t);//write
-    	write_storage(const write_storage&) ;
+    	write_storage(uint64_t, const A&);//write
+    	write_storage(const write_storage&, const A&);
     	write_storage& operator=(const write_storage&) = delete;
     	~write_storage();
-        kvector<std::map<K,V> > storage;
-        global_lock* locks;
-        kmap_iterator<K,V> find(const K&);
-        const_kmap_iterator<K,V> find(const K&) const;
-        void inserting(const K&, const V&); //write
+        kvector<bucket_type> storage;
+        lock_stripes<global_lock>* locks; //nullptr unless several threads write
+        void set_lock(uint64_t, bool); //lock of the bucket at the index
+        template <class Q>
+        iterator find(const Q&);
+        template <class Q>
+        const_iterator find(const Q&) const;
+        template <class Key, class... Args>
+        std::pair<iterator, bool> try_inserting(Key&&, Args&&...); //write
     };
     write_storage* write;
-    void move_write_storage();
-    void combine_read_write();
-    void inserting(const K&, const V&); //write
+    int64_t move_bucket(uint64_t);
+    void move_write_storage(unsigned);
+    void setup_write_locks();
+    void combine_read_write(unsigned);
+    int64_t merge_bucket(uint64_t);
+    void merge_rehashed(uint64_t, unsigned);
+    int64_t merge_node(uint64_t, typename bucket_type::node_type&&);
+    template <class Key, class... Args>
+    std::pair<iterator, bool> try_inserting(Key&&, Args&&...); //write
+    template <class Pair>
+    static bool assign_in_bucket(bucket_type&, Pair&&);
+    void inserting_node(typename bucket_type::node_type&&); //write
+    //!the published buckets of lock free reads, a table is replaced as a whole when the map grows
+    struct version_table
+    {
+        explicit version_table(uint64_t);
+        version_table(const version_table&) = delete;
+        version_table& operator=(const version_table&) = delete;
+        ~version_table(); //!deletes the buckets as well
+        uint64_t size;
+        std::atomic<bucket_type*>* buckets;
+    };
+    static void delete_bucket(void*);
+    static void delete_versions(void*);
+    struct concurrent_storage
+    {
+        concurrent_storage(uint64_t, uint64_t);
+        concurrent_storage(const concurrent_storage&) = delete;
+        concurrent_storage& operator=(const concurrent_storage&) = delete;
+        ~concurrent_storage();
+        //!the lock of a key is the stripe of the slot it hashes to out of lock_count slots. the table only grows
+        //!by doubling from lock_count buckets, so all of the keys of a bucket share a slot and a lock
+        lock_stripes<shared_global_lock> locks;
+        uint64_t lock_count;
+        std::atomic<int64_t> change; //entries inserted minus entries removed since the last growth
+        std::atomic<version_table*> versions; //nullptr unless the reads are lock free
+        epoch_domain epochs;
+    };
+    //!holds the lock of a bucket for as long as it exists
+    struct bucket_lock
+    {
+        bucket_lock(shared_global_lock&, bool);
+        bucket_lock(const bucket_lock&) = delete;
+        bucket_lock& operator=(const bucket_lock&) = delete;
+        ~bucket_lock();
+        shared_global_lock& lock;
+        bool exclusive;
+    };
+    concurrent_storage* shared;
+    template <class Q>
+    shared_global_lock& key_lock(const Q&) const;
+    void lock_all(bool);
+    void concurrent_grow(uint64_t);
+    void grow_versions();
+    void publish(uint64_t, std::unique_ptr<bucket_type>);
+    void copy_versions(const kmap&);
+    void check_references() const;
+    //!the Existing of locked_inserting which leaves the value of a key already there alone
+    struct keep_value
+    {
+        void operator()(V&) const {}
+    };
+    template <class Existing, class Key, class... Args>
+    std::pair<iterator, bool> locked_inserting(Existing, Key&&, Args&&...);
+    template <class Q>
+    V* locked_value(const Q&);
+    //!shared by the map and a view it handed out, see snapshot()
+    struct snapshot_state
+    {
+        snapshot_state(const bucket_type*, uint64_t, uint64_t, uint64_t, const A&);
+        snapshot_state(const snapshot_state&) = delete;
+        snapshot_state& operator=(const snapshot_state&) = delete;
+        ~snapshot_state(); //!deletes the copies as well
+        const bucket_type* live; //first bucket of the map, read for the buckets which have no copy yet
+        uint64_t size; //number of buckets
+        uint64_t entries;
+        std::atomic<bucket_type*>* copies; //nullptr while the bucket is shared with the map
+        //!readers hold the lock of a shared bucket, the map holds it while it copies the bucket
+        lock_stripes<shared_global_lock> locks;
+        std::atomic<bool> released; //the view is gone, so its buckets needn't be copied any more
+        A alloc; //of the copies, never the resource of the map which clear() releases
+    };
+    std::vector<std::shared_ptr<snapshot_state> > snapshots;
+    void before_write(uint64_t);
+    void mark_dirty(uint64_t);
+    template <class Q>
+    void before_insert(uint64_t, const Q&);
+    static void announce_write(void*, uint64_t, const K&);
+    template <class Q>
+    uint64_t erase_in_bucket(uint64_t, const Q&);
+    void preserve(uint64_t);
+    void copy_shared(snapshot_state&, uint64_t);
+    void detach_snapshots();
+    void before_table_write();
+    friend class kmap_snapshot<K,V,H,I,B,A>;
+    static void write_bucket(kmap_image_writer&, std::vector<const std::pair<const K, V>*>&, std::vector<uint64_t>&);
+    void write_log_bucket(kmap_image_writer&, uint64_t) const;
+    template <class T>
+    static uint64_t encoded_length(const char*, uint64_t);
+    static uint64_t log_record_size(const char*, uint64_t, const kmap_log_header&);
+    void apply_log_record(const char*, const kmap_log_header&);
+    void replay_log(const mapped_file&, uint64_t&);
+    void rebuild_table(uint64_t);
+};
+
+//!read-only view of a kmap as it was when kmap::snapshot() was called (see there). the view can only be moved,
+//!the moved from view can only be assigned to or destroyed
+template <class K, class V, class H, class I, class B, class A>
+class kmap_snapshot
+{
+public:
+    typedef typename kmap<K,V,H,I,B,A>::bucket_type bucket_type;
+    kmap_snapshot(kmap_snapshot&&) = default;
+    kmap_snapshot& operator=(kmap_snapshot&&);
+    kmap_snapshot(const kmap_snapshot&) = delete;
+    kmap_snapshot& operator=(const kmap_snapshot&) = delete;
+    ~kmap_snapshot(); //!the map stops copying buckets for the view
+    uint64_t entry_number() const;
+    bool empty() const;
+    uint64_t hash_size() const; //!number of buckets, the second for_each takes a range of them
+    bool contains(const K&) const;
+    template <class Function>
+    bool visit(const K&, Function) const; //!calls the function with the value of the key if it exists
+    //!calls the function with every key-value pair, a bucket still shared with the map is read under its lock
+    //!so the function shouldn't wait for a writer of the map
+    template <class Function>
+    void for_each(Function) const;
+    template <class Function>
+    void for_each(Function, uint64_t, uint64_t) const; //!only the pairs of the buckets [first, last)
+private:
+    typedef typename kmap<K,V,H,I,B,A>::snapshot_state state_type;
+    typedef typename kmap<K,V,H,I,B,A>::bucket_lock bucket_lock;
+    explicit kmap_snapshot(std::shared_ptr<state_type>);
+    std::shared_ptr<state_type> state;
+    template <class Function>
+    void read_bucket(uint64_t, Function) const;
+    void release();
+    friend class kmap<K,V,H,I,B,A>;
 };
 
 //defining static variables
-template <class K, class V>
-const double kmap<K,V>::a=geta();
+template <class K, class V, class H, class I, class B, class A>
+const uint64_t kmap<K,V,H,I,B,A>::map_size=64;
+
+template <class K, class V, class H, class I, class B, class A>
+const uint64_t kmap<K,V,H,I,B,A>::batch_window=64;
+template <class K, class V, class H, class I, class B, class A>
+const uint64_t kmap<K,V,H,I,B,A>::ranges_per_thread=8;
 
-template <class K, class V>
-const uint64_t kmap<K,V>::map_size=64;
+template <class K, class V, class H, class I, class B, class A>
+const uint64_t kmap<K,V,H,I,B,A>::prefetch_distance=8;
+
+template <class K, class V, class H, class I, class B, class A>
+const uint64_t kmap<K,V,H,I,B,A>::default_stripes=1024;
+
+template <class K, class V, class H, class I, class B, class A>
+const unsigned kmap<K,V,H,I,B,A>::default_lock_spin=256;
 
 //write storage constructor
-template <class K, class V>
-kmap<K,V>::write_storage::write_storage(uint64_t size): storage(size)
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::write_storage::write_storage(uint64_t size, const A& alloc): storage(make_table(size, alloc))
 {
 	locks = nullptr;
 }
 
 //write storage assignment operator
-template <class K, class V>
-kmap<K,V>::write_storage::write_storage(const write_storage& other)
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::write_storage::write_storage(const write_storage& other, const A& alloc): storage(copy_table(other.storage, alloc))
 {
 	//this does not copy other exactly except for storage and entries.
 	//locks if it exists in other is created but set to the default values
-	this->storage = other.storage;
 	if (other.locks != nullptr)
-		locks = new global_lock[storage.getcapacity()];
+		locks = new lock_stripes<global_lock>(other.locks->size());
 	else
 		locks = nullptr;
 }
 
-template <class K, class V>
-kmap<K,V>::write_storage::~write_storage()
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::write_storage::~write_storage()
+{
+	delete locks;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::write_storage::set_lock(uint64_t index, bool setting)
 {
-	delete[] locks;
+	if (locks != nullptr)
+		(*locks)[index].set_lock(setting);
 }
 
-template <class K, class V>
-kmap_iterator<K,V> kmap<K,V>::write_storage::find(const K& key)
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+typename kmap<K,V,H,I,B,A>::iterator kmap<K,V,H,I,B,A>::write_storage::find(const Q& key)
 {
 	//copy current find but modify
-	unsigned long long converted = hashvalue(key);
-	uint64_t index = hashing(converted, storage.getcapacity(), a);
-	kvector_iterator<std::map<K, V> > vector_index(&storage[index]);
-	typename std::map<K,V>::iterator it = storage[index].find(key);
-	kmap_iterator<K,V> key_position(vector_index, it, storage.end());
+	uint64_t index = bucket_index(key, storage.getcapacity());
+	kvector_iterator<bucket_type> vector_index(&storage[index]);
+	typename bucket_type::iterator it = storage[index].find(key);
+	iterator key_position(vector_index, it, storage.end());
 	return key_position;
 }
 
-template <class K, class V>
-const_kmap_iterator<K,V> kmap<K,V>::write_storage::find(const K& key) const
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+typename kmap<K,V,H,I,B,A>::const_iterator kmap<K,V,H,I,B,A>::write_storage::find(const Q& key) const
 {
  //copy current find but modify
-	unsigned long long converted = hashvalue(key);
-	uint64_t index = hashing(converted, storage.getcapacity(), a);
-	const_kvector_iterator<std::map<K,V> > vector_index(&storage[index]);
-	typename std::map<K,V>::const_iterator it = storage[index].find(key);
-	const_kmap_iterator<K,V> key_position(vector_index, it, storage.end());
+	uint64_t index = bucket_index(key, storage.getcapacity());
+	const_kvector_iterator<bucket_type> vector_index(&storage[index]);
+	typename bucket_type::const_iterator it = storage[index].find(key);
+	const_iterator key_position(vector_index, it, storage.end());
 	return key_position;
 }
 
-template <class K, class V>
-void kmap<K,V>::write_storage::inserting(const K& key, const V& val)
+template <class K, class V, class H, class I, class B, class A>
+template <class Key, class... Args>
+std::pair<typename kmap<K,V,H,I,B,A>::iterator, bool> kmap<K,V,H,I,B,A>::write_storage::try_inserting(Key&& key, Args&&... args)
 {
-	unsigned long long converted = hashvalue(key);
-	uint64_t index = hashing(converted, storage.getcapacity(), a);
-	if (locks != nullptr)
-		locks[index].set_lock(true);
-	//!insert key-value combination in std::map located at index and update entries by 1
-	storage[index][key] = val;
-	//std::cout<<"the key is "<<key<<" and the value is "<<values[index][key]<<std::endl; //testing if insert actually works
-	if (locks != nullptr)
-		locks[index].set_lock(false);
+	uint64_t index = bucket_index(key, storage.getcapacity());
+	set_lock(index, true);
+	//!the key-value combination is built in place in the bucket located at index if the key is new
+	std::pair<typename bucket_type::iterator, bool> result = storage[index].try_emplace(std::forward<Key>(key), std::forward<Args>(args)...);
+	set_lock(index, false);
+	return std::pair<iterator, bool>(iterator(&storage[index], result.first, storage.end()), result.second);
 }
 
-template <class K, class V>
-kmap<K,V>::kmap() : entries(0), write(nullptr) //default constructor
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::kmap() : alloc(), entries(0), values(make_table(I::table_size(2), alloc)), occupied(values.getcapacity()),
+    dirty(), all_dirty(true), checkpoints(0), rehash_step(0), old_m(0), migrated(0),
+    workers(1), stripes(default_stripes), lock_spin(default_lock_spin),
+    lock_counting(false), write(nullptr), shared(nullptr) //default constructor
 {
     init_hash_props();
 }//!default initialization of values and it
 
-template <class K, class V>
-kmap<K,V>::kmap(uint64_t size) : entries(0),
-    values(ceil(double(size)/map_size)), write(nullptr) //constructor which presizes kmap
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::kmap(uint64_t size) : kmap(size, A()) //constructor which presizes kmap
 {
-    //need to make sure the size of value and it is greater than or equal to 2
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::kmap(const A& input) : alloc(input), entries(0), values(make_table(I::table_size(2), alloc)),
+    occupied(values.getcapacity()), dirty(), all_dirty(true), checkpoints(0), rehash_step(0), old_m(0), migrated(0),
+    workers(1), stripes(default_stripes), lock_spin(default_lock_spin),
+    lock_counting(false), write(nullptr), shared(nullptr)
+{
+    init_hash_props();
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::kmap(uint64_t size, const A& input) : alloc(input), entries(0),
+    values(make_table(I::table_size(ceil(double(size)/map_size)), alloc)), occupied(values.getcapacity()), dirty(),
+    all_dirty(true), checkpoints(0), rehash_step(0), old_m(0), migrated(0), workers(1),
+    stripes(default_stripes), lock_spin(default_lock_spin),
+    lock_counting(false), write(nullptr), shared(nullptr)
+{
+    //the index policy makes sure the size of value and it is greater than or equal to 2
     //a size below that value makes hashing useless
     //std::cout<<"size is"<<size<<std::endl;
-    if (values.getcapacity() < 2)
-    {
-        values.resize(2);
-    }
     init_hash_props();
 }
 
-template <class K, class V>
-kmap<K,V>::kmap(const kmap<K,V>& input) : entries(input.entries), values(input.values),
-     kmap_size(input.kmap_size), m(input.m)
-
-{//The copy constructor for the vector only works correctly when size and capacity are the same.
-    //If they are not the same, the objects in the vector do not get copied over.
-    //Therefore, they need to be manually copied when capacity and size are not the same.
-    //!additional note: because of how kmap works the steps below will never ever repeat
-    //!the steps in the vector copy constructor.
-    if (values.getsize() != values.getcapacity())
-    {
-        for (int i=0; i<values.getcapacity(); i++)
-        {
-            values[i]=input.values[i];
-        }
-    }
+//!the copy allocates from the allocator chosen by select_on_container_copy_construction
+//!(the heap for kmap_allocator, a resource is never shared by two maps)
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::kmap(const kmap<K,V,H,I,B,A>& input) :
+     alloc(std::allocator_traits<A>::select_on_container_copy_construction(input.alloc)), entries(input.entry_number()),
+     values(copy_table(input.values, alloc)), occupied(input.occupied), dirty(), all_dirty(true),
+     checkpoints(input.checkpoints), kmap_size(input.kmap_size), m(input.m), rehash_step(input.rehash_step),
+     old_m(input.old_m), migrated(input.migrated), workers(input.workers), stripes(input.stripes),
+     lock_spin(input.lock_spin), lock_counting(input.lock_counting), lock_history(input.lock_history), shared(nullptr)
+{
     //!handling the write_storage pointer
     if (input.write != nullptr) {
-        this->write = new write_storage(*(input.write));
+        this->write = new write_storage(*(input.write), alloc);
+        setup_write_locks();
     }
     else
         this->write = nullptr;
+    copy_versions(input);
+    if (input.lock_free_reads())
+        track_table();
 }
 
-template <class K, class V>
-kmap<K,V>& kmap<K,V>::operator=(const kmap<K,V>& input)
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>& kmap<K,V,H,I,B,A>::operator=(const kmap<K,V,H,I,B,A>& input)
 {
-    this->entries = input.entries;
-    this->values = input.values; //assignment operator for the vector
+    if (this == &input)
+        return *this;
+    //!the number of locks follows the table size, so concurrent mode is started again for the new table
+    bool was_concurrent = concurrent();
+    bool was_lock_free = lock_free_reads();
+    end_concurrent();
+    before_table_write();
+    //!the old buckets are dropped before the copy is made
+    delete write;
+    write = nullptr;
+    values = kvector<bucket_type>(0);
+    if (std::allocator_traits<A>::propagate_on_container_copy_assignment::value)
+        this->alloc = input.alloc;
+    this->entries = input.entry_number(); //!includes the changes of concurrent mode
+    this->values = copy_table(input.values, alloc);
+    this->occupied = input.occupied;
+    //!the sequence never goes back, the log of this map may have records up to its own number
+    this->checkpoints = std::max(this->checkpoints, input.checkpoints);
+    copy_versions(input);
+    if (input.lock_free_reads())
+        track_table();
     this->kmap_size = input.kmap_size;
     this->m = input.m;
-    //The assignment operator for the vector only works correctly when size and capacity are the same.
-    //If they are not the same, the objects in the vector do not get copied over.
-    //Therefore, they need to be manually copied when capacity and size are not the same.
-    //!additional note: because of how kmap works the steps below will never ever repeat
-    //!the steps in the vector assignment operator.
-    if (values.getsize() != values.getcapacity())
-    {
-        for (int i=0; i<values.getcapacity(); i++)
-        {
-            values[i]=input.values[i];
-        }
-    }
+    this->rehash_step = input.rehash_step;
+    this->old_m = input.old_m;
+    this->migrated = input.migrated;
+    this->workers = input.workers;
+    this->stripes = input.stripes;
+    this->lock_spin = input.lock_spin;
+    this->lock_counting = input.lock_counting;
+    this->lock_history = input.lock_history;
     //!handling the write_storage pointer
-    delete write;
     if (input.write != nullptr) {
-        this->write = new write_storage(*(input.write));
+        this->write = new write_storage(*(input.write), alloc);
+        setup_write_locks();
     }
-    else
-        this->write = nullptr;
+    if (was_concurrent)
+        begin_concurrent(was_lock_free);
     return *this;
 }
 
-template <class K, class V>
-kmap<K,V>::kmap(kmap<K,V>&& input): entries(std::move(input.entries)), values(std::move(input.values)),
-     kmap_size(std::move(input.kmap_size)), m(std::move(input.m))
+//!the allocator always moves along with the buckets
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::kmap(kmap<K,V,H,I,B,A>&& input): alloc(input.alloc), entries(std::move(input.entries)), values(std::move(input.values)),
+     occupied(std::move(input.occupied)), dirty(std::move(input.dirty)), all_dirty(input.all_dirty),
+     checkpoints(input.checkpoints), kmap_size(std::move(input.kmap_size)), m(std::move(input.m)), rehash_step(input.rehash_step),
+     old_m(input.old_m), migrated(input.migrated), workers(input.workers), stripes(input.stripes),
+     lock_spin(input.lock_spin), lock_counting(input.lock_counting), lock_history(input.lock_history)
 {
     this->write = input.write;
     input.write = nullptr;
+    this->shared = input.shared;
+    input.shared = nullptr;
+    //!the views keep on sharing the buckets, which moved along with the table
+    snapshots.swap(input.snapshots);
+    input.all_dirty = true;
 }
 
-template <class K, class V>
-kmap<K,V>& kmap<K,V>::operator=(kmap<K,V>&& input)
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>& kmap<K,V,H,I,B,A>::operator=(kmap<K,V,H,I,B,A>&& input)
 {
+    detach_snapshots();
     entries = std::move(input.entries);
     values = std::move(input.values);
+    occupied = std::move(input.occupied);
+    dirty = std::move(input.dirty);
+    all_dirty = input.all_dirty;
+    checkpoints = input.checkpoints;
+    input.all_dirty = true;
+    alloc = input.alloc;
     kmap_size = std::move(input.kmap_size);
     m = std::move(input.m);
+    rehash_step = input.rehash_step;
+    old_m = input.old_m;
+    migrated = input.migrated;
+    workers = input.workers;
+    stripes = input.stripes;
+    lock_spin = input.lock_spin;
+    lock_counting = input.lock_counting;
+    lock_history = input.lock_history;
     delete write;
     this->write = input.write;
     input.write = nullptr;
+    delete shared;
+    this->shared = input.shared;
+    input.shared = nullptr;
+    snapshots.swap(input.snapshots);
     return *this;
 }
 
-template <class K, class V>
-kmap<K,V>::~kmap()
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::~kmap()
 {
+	detach_snapshots(); //!the views outlive the buckets they share
 	delete write;
+	delete shared;
 }
 
-template <class K, class V>
-void kmap<K,V>::init_hash_props()
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::init_hash_props()
 {
     m = values.getcapacity();//number of slots that hashing function can place values in
     kmap_size = m * map_size;//number of total slots that kmap can assign before growing and rehashing
 }
 
 //!removes all of the data from kmap and returns the data structures to their default size of 2
-template <class K, class V>
-void kmap<K,V>::clear()
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::clear()
 {
+    bool was_concurrent = concurrent();
+    bool was_lock_free = lock_free_reads();
+    end_concurrent();
+    before_table_write();
     values.clear();
-    values.resize(2);
+    //!none of the buckets hold memory any more, so the resource of the allocator can be released all at once
+    if (write == nullptr)
+        kmap_release(alloc);
+    values.resize(I::table_size(2), alloc);
     /** The above clear/resize remove the possibility
     for memory problems due to operations on an array
     with a size of 0.*/
     init_hash_props();//to reset the size of m which keeps track of the size of the array
+    track_table();
     entries=0;
+    old_m=0;//nothing left to migrate
+    migrated=0;
+    if (was_concurrent)
+        begin_concurrent(was_lock_free);
+}
+
+//!builds a table of the given size whose empty buckets use the allocator
+template <class K, class V, class H, class I, class B, class A>
+kvector<typename kmap<K,V,H,I,B,A>::bucket_type> kmap<K,V,H,I,B,A>::make_table(uint64_t size, const A& alloc)
+{
+    kvector<bucket_type> table(0);
+    table.resize(size, alloc);
+    return table;
+}
+
+//!copies every bucket of the source into a table whose buckets use the allocator
+template <class K, class V, class H, class I, class B, class A>
+kvector<typename kmap<K,V,H,I,B,A>::bucket_type> kmap<K,V,H,I,B,A>::copy_table(const kvector<bucket_type>& source, const A& alloc)
+{
+    kvector<bucket_type> table(0);
+    table.reserve(source.getcapacity());
+    for (uint64_t i = 0; i < source.getcapacity(); i++)
+        table.emplace_back(source[i], alloc);
+    return table;
 }
 
 //!removes all of the data from kmap but keeps the data structures the same size
-template <class K, class V>
-void kmap<K,V>::clean()
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::clean()
 {
-    values.clean();
+    bool was_concurrent = concurrent();
+    bool was_lock_free = lock_free_reads();
+    end_concurrent();
+    before_table_write();
+    //!the buckets are rebuilt in place, the empty buckets hold no memory so the resource can be released afterwards
+    values.clean(alloc);
+    values.resize(m, alloc);
+    track_table();
+    if (write == nullptr)
+        kmap_release(alloc);
     entries = 0;//because this is a new map with 0 entries filled in
+    old_m = 0;//nothing left to migrate
+    migrated = 0;
+    if (was_concurrent)
+        begin_concurrent(was_lock_free);
 }
 
-//!inserts the key and value into the map
-template <class K, class V> //!bug fixed
-void kmap<K,V>::insert(const K& key, const V& val)
+//!inserts the key and value into the map, the value is replaced if the key already exists
+template <class K, class V, class H, class I, class B, class A> //!bug fixed
+void kmap<K,V,H,I,B,A>::insert(const K& key, const V& val)
 {
-	if (write != nullptr)
-		write->inserting(key, val);
-	else
-		inserting(key, val);
+	insert_or_assign(key, val);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::insert(K&& key, V&& val)
+{
+	insert_or_assign(std::move(key), std::move(val));
+}
+
+//!the pair is built before the key can be looked up, like std::map::emplace
+template <class K, class V, class H, class I, class B, class A>
+template <class... Args>
+std::pair<typename kmap<K,V,H,I,B,A>::iterator, bool> kmap<K,V,H,I,B,A>::emplace(Args&&... args)
+{
+	std::pair<K, V> pair(std::forward<Args>(args)...);
+	return try_inserting(std::move(pair.first), std::move(pair.second));
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class... Args>
+std::pair<typename kmap<K,V,H,I,B,A>::iterator, bool> kmap<K,V,H,I,B,A>::try_emplace(const K& key, Args&&... args)
+{
+	return try_inserting(key, std::forward<Args>(args)...);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class... Args>
+std::pair<typename kmap<K,V,H,I,B,A>::iterator, bool> kmap<K,V,H,I,B,A>::try_emplace(K&& key, Args&&... args)
+{
+	return try_inserting(std::move(key), std::forward<Args>(args)...);
+}
+
+//!the pairs are only read twice: once to hash the keys and once to insert them.
+//!single pass input iterators are first copied into a buffer
+template <class K, class V, class H, class I, class B, class A>
+template <class InputIt>
+void kmap<K,V,H,I,B,A>::insert_range(InputIt first, InputIt last, unsigned threads)
+{
+	typedef typename std::iterator_traits<InputIt>::iterator_category category;
+	if constexpr (std::is_same<category, std::input_iterator_tag>::value) {
+		std::vector<std::pair<K, V> > buffer;
+		for (; first != last; ++first)
+			buffer.emplace_back(*first);
+		insert_range(std::make_move_iterator(buffer.begin()), std::make_move_iterator(buffer.end()), threads);
+	}
+	else if (write != nullptr || shared != nullptr) {
+		//!the write storage or the concurrent map is filled by several threads at once, so the pairs are inserted one by one
+		for (; first != last; ++first) {
+			typename std::iterator_traits<InputIt>::reference pair = *first;
+			insert_or_assign(std::forward<decltype(pair)>(pair).first, std::forward<decltype(pair)>(pair).second);
+		}
+	}
+	else {
+		std::vector<InputIt> items;
+		for (; first != last; ++first)
+			items.push_back(first);
+		uint64_t n = items.size();
+		if (n == 0)
+			return;
+		//!presize so the table never grows while it is filled
+		resize(entries + n);
+		finish_rehash();
+		unsigned count = threads == 0 ? 1 : threads;
+		if (n < 2 * uint64_t(count) || m < 2 * uint64_t(count))
+			count = 1;
+
+		//!hash pass
+		std::vector<uint64_t> index(n);
+		run_parallel(count, [&](unsigned t) {
+			for (uint64_t i = n * t / count; i < n * (t + 1) / count; i++)
+				index[i] = bucket_index((*items[i]).first, m);
+		});
+
+		//!counting sort of the pairs by bucket, the pairs of one bucket keep the input order
+		std::vector<uint64_t> start(m + 1, 0);
+		for (uint64_t i = 0; i < n; i++)
+			start[index[i] + 1] += 1;
+		for (uint64_t b = 0; b < m; b++)
+			start[b + 1] += start[b];
+		std::vector<uint64_t> order(n);
+		{
+			std::vector<uint64_t> next(start.begin(), start.end() - 1);
+			for (uint64_t i = 0; i < n; i++)
+				order[next[index[i]]++] = i;
+		}
+
+		//!fill pass: every thread owns a range of buckets so no locks are needed
+		std::vector<uint64_t> added(count, 0);
+		run_parallel(count, [&](unsigned t) {
+			for (uint64_t b = m * t / count; b < m * (t + 1) / count; b++) {
+				if (start[b] == start[b + 1])
+					continue;
+				before_write(b);
+				for (uint64_t j = start[b]; j < start[b + 1]; j++) {
+					if (assign_in_bucket(values[b], *items[order[j]]))
+						added[t] += 1;
+				}
+				occupied.set(b);
+			}
+		});
+		for (unsigned t = 0; t < count; t++)
+			entries += added[t];
+	}
+}
+
+//!inserts the pair into the bucket or assigns its value, returns true if the key was new
+template <class K, class V, class H, class I, class B, class A>
+template <class Pair>
+bool kmap<K,V,H,I,B,A>::assign_in_bucket(bucket_type& bucket, Pair&& pair)
+{
+	std::pair<typename bucket_type::iterator, bool> result = bucket.try_emplace(std::forward<Pair>(pair).first, std::forward<Pair>(pair).second);
+	if (!result.second)
+		result.first->second = std::forward<Pair>(pair).second;
+	return result.second;
+}
+
+//!the value is only moved from once: into the new pair when the key is new, otherwise into the existing value
+template <class K, class V, class H, class I, class B, class A>
+template <class M>
+std::pair<typename kmap<K,V,H,I,B,A>::iterator, bool> kmap<K,V,H,I,B,A>::insert_or_assign(const K& key, M&& obj)
+{
+	if (shared != nullptr)
+		return locked_inserting([&](V& value) {value = std::forward<M>(obj);}, key, std::forward<M>(obj));
+	std::pair<iterator, bool> result = try_inserting(key, std::forward<M>(obj));
+	if (!result.second)
+		result.first->second = std::forward<M>(obj);
+	return result;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class M>
+std::pair<typename kmap<K,V,H,I,B,A>::iterator, bool> kmap<K,V,H,I,B,A>::insert_or_assign(K&& key, M&& obj)
+{
+	if (shared != nullptr)
+		return locked_inserting([&](V& value) {value = std::forward<M>(obj);}, std::move(key), std::forward<M>(obj));
+	std::pair<iterator, bool> result = try_inserting(std::move(key), std::forward<M>(obj));
+	if (!result.second)
+		result.first->second = std::forward<M>(obj);
+	return result;
+}
+
+//!returns the index of the hash table of the given size the key is placed in
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+uint64_t kmap<K,V,H,I,B,A>::bucket_index(const Q& key, uint64_t size)
+{
+    unsigned long long converted = H()(key);
+    return I::index(converted, size);
 }
 
 //!rehashes values using new value for m. moves key-value pairs that hash to a different section of the hash table and than deletes them from their
 //!old position
-template <class K, class V>
-void kmap<K,V>::rehash(uint64_t old_m)
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::rehash(uint64_t previous_m)
 {
-    typename std::map<K,V>::iterator hash_it;
-    std::vector<K> deleted_keys; //this stores the keys that have been moved to a different map so they can all be deleted at the same time
-    unsigned long long converted;
-    uint64_t index;
+    if (workers > 1 && previous_m >= 2 * workers) {
+        parallel_rehash(previous_m);
+        return;
+    }
+    for (uint64_t i=0; i<previous_m; i++) //!O(N) to go through all data in the maps, O(Log(N)) for each delete and O(log(N)) for each insert
+        rehash_bucket(i);
+}
 
-    for (uint64_t i=0; i<old_m; i++) //!O(N) to go through all data in the maps, O(Log(N)) for each delete and O(log(N)) for each insert
-    {
-        //! check to make sure std::map at index i is not empty if so go to next index
-        if (values[i].empty())
-            continue;
-        //!otherwise iterate through map
-        for (hash_it=values[i].begin(); hash_it!=values[i].end(); hash_it++)
-        {
-            converted=hashvalue(hash_it->first);
-            index=hashing(converted, m, a);
-            if(index != i) {
-                //move key and value to map with that index and append key to deleted_keys
-                values[index][hash_it->first]=hash_it->second;
-                deleted_keys.push_back(hash_it->first);
+//!two phase rehash so the threads never touch the same bucket at the same time.
+//!phase 1: every thread owns a range of the old buckets and extracts the pairs which have to move,
+//!sorting them by the thread which owns their new bucket.
+//!phase 2: every thread owns a range of the new buckets and inserts the pairs addressed to it.
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::parallel_rehash(uint64_t previous_m)
+{
+    typedef std::vector<std::pair<uint64_t, typename bucket_type::node_type> > outbox;
+    const unsigned n = workers;
+    std::vector<outbox> moved(n * n); //moved[source thread * n + destination thread]
+
+    run_parallel(n, [&](unsigned t) {
+        uint64_t first = previous_m * t / n;
+        uint64_t last = previous_m * (t + 1) / n;
+        for (uint64_t i = first; i < last; i++) {
+            typename bucket_type::iterator hash_it = values[i].begin();
+            while (hash_it != values[i].end()) {
+                uint64_t index = bucket_index(hash_it->first, m);
+                if (index != i) {
+                    typename bucket_type::iterator next = hash_it;
+                    ++next;
+                    moved[t * n + index * n / m].push_back(std::make_pair(index, values[i].extract(hash_it)));
+                    hash_it = next;
+                }
+                else
+                    ++hash_it;
             }
+            if (values[i].empty())
+                occupied.reset(i);
         }
-        //!test if any keys need deleting from the map at index i than delete the keys and clear the vector deleted_keys
-        if(!deleted_keys.empty()) {
-            for (size_t j=0; j < deleted_keys.size(); j++) {
-                values[i].erase(deleted_keys[j]);
+    });
+
+    run_parallel(n, [&](unsigned t) {
+        for (unsigned source = 0; source < n; source++) {
+            outbox& box = moved[source * n + t];
+            for (size_t j = 0; j < box.size(); j++) {
+                values[box[j].first].insert(std::move(box[j].second));
+                occupied.set(box[j].first);
             }
-            deleted_keys.clear();
+            outbox().swap(box);
+        }
+    });
+}
+
+//!runs fn(0) ... fn(n-1) on n threads (the calling thread runs fn(0)) and waits for all of them.
+//!the first exception thrown by any of the threads is rethrown after they finish.
+//!when a thread can't be started (std::system_error once the system runs out of threads) the calling thread runs
+//!the parts left over itself: the callers are in the middle of a rehash or merge and can't stop there
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+void kmap<K,V,H,I,B,A>::run_parallel(unsigned n, Function fn)
+{
+    std::vector<std::exception_ptr> errors(n);
+    auto run = [&fn, &errors](unsigned t) {
+        try {
+            fn(t);
+        }
+        catch (...) {
+            errors[t] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    unsigned started = 1;
+    try {
+        threads.reserve(n - 1);
+        for (; started < n; started++)
+            threads.emplace_back(run, started);
+    }
+    catch (...) {
+        //!the threads running already are joined below
+    }
+    run(0);
+    for (unsigned t = started; t < n; t++)
+        run(t);
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    for (unsigned t = 0; t < n; t++) {
+        if (errors[t])
+            std::rethrow_exception(errors[t]);
+    }
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::rehash_threads(unsigned count)
+{
+    workers = count == 0 ? 1 : count;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::stripe_count(uint64_t count)
+{
+    stripes = count == 0 ? 1 : count;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::lock_spin_limit(unsigned limit)
+{
+    lock_spin = limit;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::count_locks(bool setting)
+{
+    lock_counting = setting;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+lock_stats kmap<K,V,H,I,B,A>::lock_statistics() const
+{
+    lock_stats result = lock_history;
+    if (write != nullptr && write->locks != nullptr)
+        result += write->locks->stats();
+    return result;
+}
+
+//!statistics of a stripe of the running write phase (zero when there is none), the stripe is
+//!the bucket index modulo the number of stripes
+template <class K, class V, class H, class I, class B, class A>
+lock_stats kmap<K,V,H,I,B,A>::lock_statistics(uint64_t stripe) const
+{
+    if (write == nullptr || write->locks == nullptr)
+        return lock_stats();
+    return write->locks->stats(stripe);
+}
+
+//!moves the key-value pairs of the bucket at index i that hash to a different bucket using the current value of m
+//!the pairs are spliced with extract/insert so the keys and values are never copied,
+//!for std::map the node itself moves to the other bucket so nothing is allocated or freed
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::rehash_bucket(uint64_t i)
+{
+    //! check to make sure the bucket at index i is not empty if so there is nothing to move
+    if (values[i].empty())
+        return;
+    typename bucket_type::iterator hash_it=values[i].begin();
+    uint64_t index;
+    while (hash_it!=values[i].end())
+    {
+        index=bucket_index(hash_it->first, m);
+        if(index != i) {
+            //!a key only exists once in kmap so the insert always succeeds
+            typename bucket_type::iterator next=hash_it;
+            ++next;
+            values[index].insert(values[i].extract(hash_it));
+            occupied.set(index);
+            hash_it=next;
         }
+        else
+            ++hash_it;
+    }
+    if (values[i].empty())
+        occupied.reset(i);
+}
+
+//!doubles the size of the hash table. depending on the rehashing mode the key-value pairs are either
+//!rehashed right away or migrated a few buckets at a time by the following operations
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::grow()
+{
+    //!a migration which is still running must finish before the table can grow again
+    finish_rehash();
+    before_table_write();
+    values.resize(I::table_size(2 * m), alloc);
+    occupied.resize(values.getcapacity());
+    uint64_t previous_m = m;
+    init_hash_props(); //find new m and new kmap_size
+    if (rehash_step == 0)
+        rehash(previous_m);
+    else {
+        old_m = previous_m;
+        migrated = 0;
     }
 }
 
+//!migrates the next rehash_step old buckets, called by insert, find and remove while a migration is running
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::migrate_step()
+{
+    uint64_t last = migrated + rehash_step < old_m ? migrated + rehash_step : old_m;
+    for (; migrated < last; migrated++)
+        rehash_bucket(migrated);
+    if (migrated == old_m)
+        old_m = 0; //!migration finished
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::incremental_rehash(uint64_t step)
+{
+    rehash_step = step;
+    if (step == 0)
+        finish_rehash();
+}
+
+template <class K, class V, class H, class I, class B, class A>
+bool kmap<K,V,H,I,B,A>::rehashing() const
+{
+    return old_m != 0;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::finish_rehash()
+{
+    for (; migrated < old_m; migrated++)
+        rehash_bucket(migrated);
+    old_m = 0;
+}
+
 //!Returns the index the key would be hashed at. If the key exists in this position sets the iterator at this position to point to the key
 //!Otherwise the iterator will point to the end
 //!This function is useful if you want to use get the key, get the value or set the value without iterating through the entire kmap
-template <class K, class V>
-kmap_iterator<K,V> kmap<K,V>::find(const K& key)
+//!note while a migration is running the bucket the key was hashed to before the growth is searched as well
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::iterator kmap<K,V,H,I,B,A>::find(const K& key)
+{
+    return find_key(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q, class>
+typename kmap<K,V,H,I,B,A>::iterator kmap<K,V,H,I,B,A>::find(const Q& key)
+{
+    return find_key(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+typename kmap<K,V,H,I,B,A>::iterator kmap<K,V,H,I,B,A>::find_key(const Q& key)
 {
-    unsigned long long converted = hashvalue(key);
-    uint64_t index = hashing(converted, m, a);
-    kvector_iterator<std::map<K, V> > vector_index(&values[index]);
-    typename std::map<K,V>::iterator it = values[index].find(key);
-    kmap_iterator<K,V> key_position(vector_index, it, values.end());
-    return key_position;
+    if (shared != nullptr) {
+        check_references();
+        bucket_lock guard(key_lock(key), false);
+        uint64_t index = bucket_index(key, m);
+        return iterator_at(index, values[index].find(key));
+    }
+    if (old_m != 0)
+        migrate_step();
+    uint64_t index = bucket_index(key, m);
+    typename bucket_type::iterator it = values[index].find(key);
+    if (old_m != 0 && it == values[index].end()) {
+        uint64_t old_index = bucket_index(key, old_m);
+        if (old_index >= migrated) {
+            typename bucket_type::iterator old_it = values[old_index].find(key);
+            if (old_it != values[old_index].end())
+                return iterator_at(old_index, old_it);
+        }
+    }
+    return iterator_at(index, it);
 }
 
 //!Returns the index the key would be hashed at. If the key exists in this position sets the iterator at this position to point to the key
 //!Otherwise the iterator will point to the end
-template <class K, class V>
-const_kmap_iterator<K,V> kmap<K,V>::find(const K& key) const
-{
-	unsigned long long converted = hashvalue(key);
-	uint64_t index = hashing(converted, m, a);
-	const_kvector_iterator<std::map<K,V> > vector_index(&values[index]);
-	typename std::map<K,V>::const_iterator it = values[index].find(key);
-	const_kmap_iterator<K,V> key_position(vector_index, it, values.end());
-	return key_position;
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::const_iterator kmap<K,V,H,I,B,A>::find(const K& key) const
+{
+    return find_key(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q, class>
+typename kmap<K,V,H,I,B,A>::const_iterator kmap<K,V,H,I,B,A>::find(const Q& key) const
+{
+    return find_key(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+typename kmap<K,V,H,I,B,A>::const_iterator kmap<K,V,H,I,B,A>::find_key(const Q& key) const
+{
+	if (shared != nullptr) {
+		check_references();
+		bucket_lock guard(key_lock(key), false);
+		uint64_t index = bucket_index(key, m);
+		return iterator_at(index, values[index].find(key));
+	}
+	uint64_t index = bucket_index(key, m);
+	typename bucket_type::const_iterator it = values[index].find(key);
+	if (old_m != 0 && it == values[index].end()) {
+		uint64_t old_index = bucket_index(key, old_m);
+		if (old_index >= migrated) {
+			typename bucket_type::const_iterator old_it = values[old_index].find(key);
+			if (old_it != values[old_index].end())
+				return iterator_at(old_index, old_it);
+		}
+	}
+	return iterator_at(index, it);
 }
 
 //!this is different than insert
 //!if the key exists in kmap then the value assigned to that key will be returned.
 //!otherwise the key will be inserted before returning a value
 //!note this algorithm will be slightly slower for inserting key value pairs than insert method
-template <class K, class V>
-V& kmap<K,V>::operator[](const K& key)
+template <class K, class V, class H, class I, class B, class A>
+V& kmap<K,V,H,I,B,A>::operator[](const K& key)
+{
+    return subscript(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+V& kmap<K,V,H,I,B,A>::operator[](K&& key)
+{
+    if (shared != nullptr)
+        check_references();
+    return try_inserting(std::move(key)).first->second;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q, class>
+V& kmap<K,V,H,I,B,A>::operator[](const Q& key)
+{
+    return subscript(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+V& kmap<K,V,H,I,B,A>::subscript(const Q& key)
 {
-	kmap_iterator<K,V> key_position;
+	if (shared != nullptr) {
+		check_references();
+		//!the key is only built when it has to be inserted
+		V* value = locked_value(key);
+		if (value != nullptr)
+			return *value;
+		return locked_inserting(keep_value(), materialize(key)).first->second;
+	}
+	iterator key_position;
 	if (write != nullptr)
 		key_position = write->find(key); //assumes no data races occur or invalidation of iterators occurs here
 	else
-		key_position = find(key);
+		key_position = find_key(key);
 
     if (key_position.in_map())
     {
@@ -592,46 +1581,132 @@ V& kmap<K,V>::operator[](const K& key)
     }
     else if (write != nullptr)
     {   
-        uint64_t index; //uninitialized
-    	if (write->locks != nullptr) {
-            unsigned long long converted = hashvalue(key);
-            //note locks has the exact same size as storage
-            index = hashing(converted, write->storage.getcapacity(), a);
-    		write->locks[index].set_lock(true);
-    	}
+        uint64_t index = bucket_index(key, write->storage.getcapacity());
+    	write->set_lock(index, true);
     	//this mechanism allows std::map to insert the key and make any needed memory allocations or modifications
-    	V& val = key_position.map()[key];
-    	if (write->locks != nullptr) {
-    		write->locks[index].set_lock(false);
-    	}
+    	V& val = key_position.map()[materialize(key)];
+    	write->set_lock(index, false);
     	return val; //returns the section of memory where V is located
     }
     else
     {
+        uint64_t vector_index = key_position.position;
         if (entries==kmap_size)
         {
-            values.resize(2*m);
-
-            uint64_t old_m = m;
-            init_hash_props();//find new m
-            rehash(old_m);
+            grow();
 
             //!Because the map was rehashed the index needs to be calculated again.
-            unsigned long long converted = hashvalue(key);
-            uint64_t vector_index = hashing(converted, m, a);
+            vector_index = bucket_index(key, m);
             key_position.index = &values[vector_index];
         }
 
         //!update entries by 1 and insert key in std::map located at index and return the reference to its mapped value
+        before_write(vector_index);
         entries+=1;
-        return key_position.map()[key];
+        occupied.set(vector_index);
+        return key_position.map()[materialize(key)];
+    }
+}
+
+//!runs resolve(i, bucket index) for every key in windows of batch_window keys.
+//!first pass: hash the keys of the window and prefetch their buckets.
+//!second pass: prefetch the inside of the bucket prefetch_distance keys ahead and resolve the current key
+template <class K, class V, class H, class I, class B, class A>
+template <class Resolve>
+void kmap<K,V,H,I,B,A>::lookup_batch(const K* keys, uint64_t n, Resolve resolve) const
+{
+    uint64_t index[batch_window];
+    for (uint64_t base = 0; base < n; base += batch_window) {
+        uint64_t count = n - base < batch_window ? n - base : batch_window;
+        for (uint64_t i = 0; i < count; i++) {
+            index[i] = bucket_index(keys[base + i], m);
+            KMAP_PREFETCH(&values[index[i]]);
+        }
+        for (uint64_t i = 0; i < count && i < prefetch_distance; i++)
+            kmap_prefetch(values[index[i]], keys[base + i]);
+        for (uint64_t i = 0; i < count; i++) {
+            if (i + prefetch_distance < count)
+                kmap_prefetch(values[index[i + prefetch_distance]], keys[base + i + prefetch_distance]);
+            resolve(base + i, index[i]);
+        }
+    }
+}
+
+//!while a migration is running the keys are looked up one by one since they may be in two buckets,
+//!in concurrent mode so that every key is searched under its lock
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::find_batch(const K* keys, uint64_t n, iterator* out)
+{
+    if (shared == nullptr && old_m != 0)
+        migrate_step();
+    if (shared != nullptr || old_m != 0) {
+        for (uint64_t i = 0; i < n; i++)
+            out[i] = find_key(keys[i]);
+        return;
+    }
+    lookup_batch(keys, n, [&](uint64_t i, uint64_t index) {
+        out[i] = iterator_at(index, values[index].find(keys[i]));
+    });
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::find_batch(const K* keys, uint64_t n, const_iterator* out) const
+{
+    if (shared != nullptr || old_m != 0) {
+        for (uint64_t i = 0; i < n; i++)
+            out[i] = find_key(keys[i]);
+        return;
+    }
+    lookup_batch(keys, n, [&](uint64_t i, uint64_t index) {
+        typename bucket_type::const_iterator it = values[index].find(keys[i]);
+        out[i] = iterator_at(index, it);
+    });
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::contains_batch(const K* keys, uint64_t n, bool* out) const
+{
+    if (shared != nullptr) {
+        for (uint64_t i = 0; i < n; i++)
+            out[i] = visit(keys[i], [](const V&) {});
+        return;
+    }
+    if (old_m != 0) {
+        for (uint64_t i = 0; i < n; i++)
+            out[i] = find_key(keys[i]).in_map();
+        return;
     }
+    lookup_batch(keys, n, [&](uint64_t i, uint64_t index) {
+        out[i] = values[index].find(keys[i]) != values[index].end();
+    });
+}
+
+template <class K, class V, class H, class I, class B, class A>
+V& kmap<K,V,H,I,B,A>::at(const K& key)
+{
+    return at_key(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q, class>
+V& kmap<K,V,H,I,B,A>::at(const Q& key)
+{
+    return at_key(key);
 }
 
-template <class K, class V>
-V& kmap<K,V>::at(const K& key)
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+V& kmap<K,V,H,I,B,A>::at_key(const Q& key)
 {
-    kmap_iterator<K,V> key_position = find(key);
+    if (shared != nullptr) {
+        check_references();
+        //!the bucket is searched under its lock, the iterator of find_key could only be checked after the lock is released
+        V* value = locked_value(key);
+        if (value == nullptr)
+            throw std::out_of_range("the key doesn't exist in the kmap");
+        return *value;
+    }
+    iterator key_position = find_key(key);
     //The method for checking if key exists below is faster than using the getvalue method and a try catch block.
     //since the try catch block will cause the code to slow down every time the key does not exist in kmap and the key needs inserting.
     if (key_position.in_map())
@@ -643,10 +1718,34 @@ V& kmap<K,V>::at(const K& key)
     }
 }
 
-template <class K, class V>
-const V& kmap<K,V>::at(const K& key) const
+template <class K, class V, class H, class I, class B, class A>
+const V& kmap<K,V,H,I,B,A>::at(const K& key) const
+{
+    return at_key(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q, class>
+const V& kmap<K,V,H,I,B,A>::at(const Q& key) const
 {
-    const_kmap_iterator<K,V> key_position = find(key);
+    return at_key(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+const V& kmap<K,V,H,I,B,A>::at_key(const Q& key) const
+{
+    if (shared != nullptr) {
+        check_references();
+        //!the bucket is searched under its lock, the iterator of find_key could only be checked after the lock is released
+        bucket_lock guard(key_lock(key), false);
+        const bucket_type& bucket = values[bucket_index(key, m)];
+        typename bucket_type::const_iterator it = bucket.find(key);
+        if (it == bucket.end())
+            throw std::out_of_range("the key doesn't exist in the kmap");
+        return it->second;
+    }
+    const_iterator key_position = find_key(key);
     //The method for checking if key exists below is faster than using the getvalue method and a try catch block.
     //since the try catch block will cause the code to slow down every time the key does not exist in kmap and the key needs inserting.
     if (key_position.in_map())
@@ -658,214 +1757,1584 @@ const V& kmap<K,V>::at(const K& key) const
     }
 }
 
-template <class K, class V>
-void kmap<K,V>::remove(const K &key)
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::remove(const K& key)
+{
+    remove_key(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q, class>
+void kmap<K,V,H,I,B,A>::remove(const Q& key)
+{
+    remove_key(key);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+void kmap<K,V,H,I,B,A>::remove_key(const Q& key)
 {
+    if (shared != nullptr) {
+        bucket_lock guard(key_lock(key), true);
+        uint64_t index = bucket_index(key, m);
+        if constexpr (std::is_copy_constructible<V>::value) {
+            version_table* table = shared->versions.load(std::memory_order_relaxed);
+            if (table != nullptr) {
+                const bucket_type& current = *table->buckets[index].load(std::memory_order_relaxed);
+                if (current.find(key) == current.end())
+                    return;
+                std::unique_ptr<bucket_type> copy(new bucket_type(current, alloc));
+                copy->erase(key);
+                before_write(index);
+                publish(index, std::move(copy));
+                shared->change.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        if (erase_in_bucket(index, key) != 0) {
+            shared->change.fetch_sub(1, std::memory_order_relaxed);
+            if (values[index].empty())
+                occupied.reset(index);
+        }
+        return;
+    }
     if (entries!=0) { //note this is the more common condition to occur so it should go first to decrease code branching.
-        unsigned long long converted=hashvalue(key);
-        uint64_t position=hashing(converted, m, a);
-        if (values[position].erase(key) != 0)//this returns the number of keys erased. If the key doesn't exist no changes will occur to the map at values[position]
+        if (old_m != 0)
+            migrate_step();
+        uint64_t position=bucket_index(key, m);
+        uint64_t erased=erase_in_bucket(position, key);//this returns the number of keys erased. If the key doesn't exist no changes will occur to the map at values[position]
         //and also no errors will be thrown.
+        if (erased == 0 && old_m != 0) {
+            //!the key may still be in the bucket it was hashed to before the growth
+            uint64_t old_position=bucket_index(key, old_m);
+            if (old_position >= migrated) {
+                erased=erase_in_bucket(old_position, key);
+                position=old_position;
+            }
+        }
+        if (erased != 0) {
             entries-=1;
+            if (values[position].empty())
+                occupied.reset(position);
+        }
     }
     //if there are no entries this method does absolutely nothing.
 }
 
 //!finds the starting point for iteration through kmap
-template <class K, class V>
-kmap_iterator<K,V> kmap<K,V>::begin()
-{//need to change algorithm to work with kmap_iterator
-    kmap_iterator<K,V> key_position;
-    if (entries!=0) { //note this is the more common condition to occur so it should go first to decrease code branching.
-        uint64_t index=0;//!start at the beginning of values
-        //!find the first index of values in which the map contains key-value pairs
-        while (values[index].empty()) {
-            index+=1;
-            if (index == m) {
-                return end();
-            }
-        }
-        key_position.it = values[index].begin();
-        key_position.index = &values[index];
-    }
-    else
-        key_position.index = values.end(); //!the position right after the end of values
-
-    key_position.end = values.end();
-    return key_position;
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::iterator kmap<K,V,H,I,B,A>::begin()
+{
+    if (entries != 0) //note this is the more common condition to occur so it should go first to decrease code branching.
+        return bucket_begin(0);
+    return end();
 }
 
 //!finds the starting point for iteration through kmap
-template <class K, class V>
-const_kmap_iterator<K,V> kmap<K,V>::begin() const
-{
-	const_kmap_iterator<K,V> key_position;
-	if (entries != 0) {
-		uint64_t index = 0; //start at the beginning of values
-		//find the first index of values in which the map contains key-value pairs
-		while (values[index].empty()) {
-			index += 1;
-			if (index == m) {
-				return end();
-			}
-		}
-		key_position.it = values[index].begin();
-		key_position.index = &values[index];
-	}
-	else
-		key_position.index = values.end(); //the position right after the end of values
-	key_position.end = values.end();
-	return key_position;
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::const_iterator kmap<K,V,H,I,B,A>::begin() const
+{
+	if (entries != 0)
+		return bucket_begin(0);
+	return end();
 }
 
 //!returns the ending point for iteration through kmap
-template <class K, class V>
-kmap_iterator<K,V> kmap<K,V>::end()
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::iterator kmap<K,V,H,I,B,A>::end()
 {
-    return kmap_iterator<K,V>(values.end());//!the position right after the end of values
+    return iterator(values.end());//!the position right after the end of values
 }
 
-template <class K, class V>
-const_kmap_iterator<K,V> kmap<K,V>::end() const
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::const_iterator kmap<K,V,H,I,B,A>::end() const
 {
-	return const_kmap_iterator<K,V>(values.end());
+	return const_iterator(values.end());
 }
 
-template <class K, class V>
-uint64_t kmap<K,V>::hash_size() const
+template <class K, class V, class H, class I, class B, class A>
+uint64_t kmap<K,V,H,I,B,A>::hash_size() const
 {
     return m;//the size of the hash table
 }
 
 //returns the map which is inside the vector or hash table at the position index
-template <class K, class V>
-std::map<K,V>& kmap<K,V>::batch(uint64_t index)
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::bucket_type& kmap<K,V,H,I,B,A>::batch(uint64_t index)
 {
+    before_write(index);
+    occupied.set(index); //!the caller may fill the bucket
     return values[index];
 }
 
-template <class K, class V>
-const std::map<K,V>& kmap<K,V>::batch(uint64_t index) const
+template <class K, class V, class H, class I, class B, class A>
+const typename kmap<K,V,H,I,B,A>::bucket_type& kmap<K,V,H,I,B,A>::batch(uint64_t index) const
 {
     return values[index];
 }
 
-//!resizes kmap but only if the inputed size is greater than the current kmap_size
-template <class K, class V>
-void kmap<K,V>::resize(uint64_t size)
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+void kmap<K,V,H,I,B,A>::parallel_for_each(Function fn)
 {
-    if(size < kmap_size)
+    parallel_for_each(fn, work_pool::standard());
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+void kmap<K,V,H,I,B,A>::parallel_for_each(Function fn, work_pool& pool)
+{
+    for_each_pair(values, fn, pool, balanced_ranges(pool_ranges(pool)), this);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+void kmap<K,V,H,I,B,A>::parallel_for_each(Function fn) const
+{
+    parallel_for_each(fn, work_pool::standard());
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+void kmap<K,V,H,I,B,A>::parallel_for_each(Function fn, work_pool& pool) const
+{
+    for_each_pair(values, fn, pool, balanced_ranges(pool_ranges(pool)), nullptr);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class T, class Reduce, class Transform>
+T kmap<K,V,H,I,B,A>::parallel_reduce(T init, Reduce reduce, Transform transform)
+{
+    return parallel_reduce(std::move(init), reduce, transform, work_pool::standard());
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class T, class Reduce, class Transform>
+T kmap<K,V,H,I,B,A>::parallel_reduce(T init, Reduce reduce, Transform transform, work_pool& pool)
+{
+    return reduce_pairs(values, std::move(init), reduce, transform, pool, balanced_ranges(pool_ranges(pool)), this);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class T, class Reduce, class Transform>
+T kmap<K,V,H,I,B,A>::parallel_reduce(T init, Reduce reduce, Transform transform) const
+{
+    return parallel_reduce(std::move(init), reduce, transform, work_pool::standard());
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class T, class Reduce, class Transform>
+T kmap<K,V,H,I,B,A>::parallel_reduce(T init, Reduce reduce, Transform transform, work_pool& pool) const
+{
+    return reduce_pairs(values, std::move(init), reduce, transform, pool, balanced_ranges(pool_ranges(pool)), nullptr);
+}
+
+//!cuts the buckets into n ranges of about the same weight, range r is [result[r], result[r + 1]).
+//!a bucket weighs its number of pairs plus one for visiting it, so long runs of empty buckets are split as well.
+//!a bucket is never split, so the ranges after one heavier than a range can be empty
+template <class K, class V, class H, class I, class B, class A>
+std::vector<uint64_t> kmap<K,V,H,I,B,A>::balanced_ranges(uint64_t n) const
+{
+    const uint64_t buckets = values.getcapacity();
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < buckets; i++)
+        total += values[i].size() + 1;
+
+    std::vector<uint64_t> result(n + 1, buckets);
+    result[0] = 0;
+    uint64_t filled = 0;
+    uint64_t next = 1;
+    for (uint64_t i = 0; i < buckets && next < n; i++) {
+        filled += values[i].size() + 1;
+        while (next < n && filled >= total * next / n)
+            result[next++] = i + 1;
+    }
+    return result;
+}
+
+//!ranges handed to a work_pool, a single thread needs no more than one
+template <class K, class V, class H, class I, class B, class A>
+uint64_t kmap<K,V,H,I,B,A>::pool_ranges(const work_pool& pool)
+{
+    return pool.size() <= 1 ? 1 : pool.size() * ranges_per_thread;
+}
+
+//!the first pair in the buckets from index on, the end iterator if they are all empty.
+//!iterators only compare their buckets, so this is also the end of a range of buckets ending before index
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::iterator kmap<K,V,H,I,B,A>::bucket_begin(uint64_t index)
+{
+    index = next_bucket(index);
+    if (index == values.getcapacity())
+        return end();
+    return iterator_at(index, values[index].begin());
+}
+
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::const_iterator kmap<K,V,H,I,B,A>::bucket_begin(uint64_t index) const
+{
+    index = next_bucket(index);
+    if (index == values.getcapacity())
+        return end();
+    return iterator_at(index, values[index].begin());
+}
+
+//!first bucket from index on holding pairs (the number of buckets if there is none), the occupancy bitmap
+//!skips the buckets known to be empty and the marked ones are checked
+template <class K, class V, class H, class I, class B, class A>
+uint64_t kmap<K,V,H,I,B,A>::next_bucket(uint64_t index) const
+{
+    const uint64_t buckets = values.getcapacity();
+    index = occupied.next(index);
+    while (index < buckets && values[index].empty())
+        index = occupied.next(index + 1);
+    return index;
+}
+
+//!iterator over values which scans the occupancy bitmap when it moves on to the next bucket
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::iterator kmap<K,V,H,I,B,A>::iterator_at(uint64_t index, typename bucket_type::iterator it)
+{
+    iterator result(&values[index], it, values.end());
+    result.occupied = occupied.data();
+    result.table = &values[0];
+    result.position = index;
+    result.announce = &announce_write;
+    result.owner = this;
+    return result;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::const_iterator kmap<K,V,H,I,B,A>::iterator_at(uint64_t index, typename bucket_type::const_iterator it) const
+{
+    const_iterator result(&values[index], it, values.end());
+    result.occupied = occupied.data();
+    result.table = &values[0];
+    result.position = index;
+    return result;
+}
+
+//!sets the bit of the bucket to whether it holds pairs, after the bucket was replaced as a whole
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::track(uint64_t index)
+{
+    if (values[index].empty())
+        occupied.reset(index);
+    else
+        occupied.set(index);
+}
+
+//!rebuilds the occupancy bitmap after the table was replaced as a whole
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::track_table()
+{
+    occupied = bucket_bitmap(values.getcapacity());
+    for (uint64_t i = 0; i < values.getcapacity(); i++) {
+        if (!values[i].empty())
+            occupied.set(i);
+    }
+}
+
+template <class K, class V, class H, class I, class B, class A>
+std::vector<std::pair<typename kmap<K,V,H,I,B,A>::iterator, typename kmap<K,V,H,I,B,A>::iterator> >
+kmap<K,V,H,I,B,A>::ranges(uint64_t n)
+{
+    std::vector<uint64_t> bounds = balanced_ranges(n == 0 ? 1 : n);
+    std::vector<std::pair<iterator, iterator> > result;
+    result.reserve(bounds.size() - 1);
+    iterator first = bucket_begin(0);
+    for (size_t r = 0; r + 1 < bounds.size(); r++) {
+        iterator last = bucket_begin(bounds[r + 1]);
+        result.push_back(std::make_pair(first, last));
+        first = last;
+    }
+    return result;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+std::vector<std::pair<typename kmap<K,V,H,I,B,A>::const_iterator, typename kmap<K,V,H,I,B,A>::const_iterator> >
+kmap<K,V,H,I,B,A>::ranges(uint64_t n) const
+{
+    std::vector<uint64_t> bounds = balanced_ranges(n == 0 ? 1 : n);
+    std::vector<std::pair<const_iterator, const_iterator> > result;
+    result.reserve(bounds.size() - 1);
+    const_iterator first = bucket_begin(0);
+    for (size_t r = 0; r + 1 < bounds.size(); r++) {
+        const_iterator last = bucket_begin(bounds[r + 1]);
+        result.push_back(std::make_pair(first, last));
+        first = last;
+    }
+    return result;
+}
+
+//!Table is values or const values, so the pairs handed to fn are mutable or const with it. the mutable version
+//!gets the map as owner and announces every bucket holding pairs before fn can change them
+template <class K, class V, class H, class I, class B, class A>
+template <class Table, class Function>
+void kmap<K,V,H,I,B,A>::for_each_pair(Table& table, Function fn, work_pool& pool, const std::vector<uint64_t>& ranges,
+                                      kmap* owner)
+{
+    typedef typename std::conditional<std::is_const<Table>::value, typename bucket_type::const_iterator,
+                                      typename bucket_type::iterator>::type pair_iterator;
+    pool.run(ranges.size() - 1, [&](uint64_t r) {
+        for (uint64_t i = ranges[r]; i < ranges[r + 1]; i++) {
+            if (owner != nullptr && !table[i].empty())
+                owner->before_write(i);
+            for (pair_iterator it = table[i].begin(); it != table[i].end(); ++it)
+                fn(*it);
+        }
+    });
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Table, class T, class Reduce, class Transform>
+T kmap<K,V,H,I,B,A>::reduce_pairs(Table& table, T init, Reduce reduce, Transform transform, work_pool& pool,
+                                  const std::vector<uint64_t>& ranges, kmap* owner)
+{
+    typedef typename std::conditional<std::is_const<Table>::value, typename bucket_type::const_iterator,
+                                      typename bucket_type::iterator>::type pair_iterator;
+    //!a range starts from its first pair, so init is only used once and needn't be the identity of reduce
+    std::vector<std::optional<T> > partial(ranges.size() - 1);
+    pool.run(ranges.size() - 1, [&](uint64_t r) {
+        for (uint64_t i = ranges[r]; i < ranges[r + 1]; i++) {
+            if (owner != nullptr && !table[i].empty())
+                owner->before_write(i);
+            for (pair_iterator it = table[i].begin(); it != table[i].end(); ++it) {
+                if (partial[r])
+                    *partial[r] = reduce(std::move(*partial[r]), transform(*it));
+                else
+                    partial[r].emplace(transform(*it));
+            }
+        }
+    });
+    for (size_t r = 0; r < partial.size(); r++) {
+        if (partial[r])
+            init = reduce(std::move(init), std::move(*partial[r]));
+    }
+    return init;
+}
+
+//!resizes kmap but only if the inputed size is greater than the current kmap_size
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::resize(uint64_t size)
+{
+    if(size < kmap_size)
         return;//!do nothing
     else
     {
-        values.resize(ceil(double(size) / map_size));
-
-        uint64_t old_m=m;
+        bool was_concurrent = concurrent();
+        bool was_lock_free = lock_free_reads();
+        end_concurrent();
+        finish_rehash();
+        before_table_write();
+        values.resize(I::table_size(ceil(double(size) / map_size)), alloc);
+        occupied.resize(values.getcapacity());
+
+        uint64_t previous_m=m;
         init_hash_props();//find new m and new kmap_size
-        rehash(old_m);
+        rehash(previous_m);
+        if (was_concurrent)
+            begin_concurrent(was_lock_free);
     }
 }
 
-template <class K, class V>
-void kmap<K,V>::swap(kmap<K,V> &other)
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::swap(kmap<K,V,H,I,B,A> &other)
 {
     std::swap(this->entries, other.entries);
     std::swap(this->kmap_size, other.kmap_size);
     std::swap(this->m, other.m);
+    std::swap(this->rehash_step, other.rehash_step);
+    std::swap(this->old_m, other.old_m);
+    std::swap(this->migrated, other.migrated);
+    std::swap(this->workers, other.workers);
+    std::swap(this->stripes, other.stripes);
+    std::swap(this->lock_spin, other.lock_spin);
+    std::swap(this->lock_counting, other.lock_counting);
+    std::swap(this->lock_history, other.lock_history);
+    std::swap(this->alloc, other.alloc); //!the allocator goes along with the buckets
+    std::swap(this->shared, other.shared); //!and so do the locks, whose number depends on the table size
     values.swap(other.values);
+    occupied.swap(other.occupied);
+    dirty.swap(other.dirty); //!the checkpoints as well
+    std::swap(this->all_dirty, other.all_dirty);
+    std::swap(this->checkpoints, other.checkpoints);
+    snapshots.swap(other.snapshots); //!the views follow the buckets they share
 }
 
-template <class K, class V>
-bool kmap<K,V>::empty() const
+template <class K, class V, class H, class I, class B, class A>
+bool kmap<K,V,H,I,B,A>::empty() const
 {
-    if (entries != 0) //note: this is the more common condition so it's first
+    if (entry_number() != 0) //note: this is the more common condition so it's first
         return false;
     else
         return true;
 }
 
-template <class K, class V>
-uint64_t kmap<K,V>::entry_number() const
+template <class K, class V, class H, class I, class B, class A>
+uint64_t kmap<K,V,H,I,B,A>::entry_number() const
 {
+    if (shared != nullptr) {
+        //!entries only changes while growth holds every lock
+        bucket_lock guard(shared->locks[0], false);
+        return uint64_t(int64_t(entries) + shared->change.load(std::memory_order_relaxed));
+    }
     return entries;
 }
 
-template <class K, class V>
-void kmap<K,V>::begin_read_write(bool parallel_write)
+template <class K, class V, class H, class I, class B, class A>
+A kmap<K,V,H,I,B,A>::get_allocator() const
+{
+    return alloc;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::begin_read_write(bool parallel_write)
 {
-	write = new write_storage(m);
-	if (parallel_write)
-		write->locks = new global_lock[m];
+	//!the write storage uses the same hashing as values so a running migration is finished first
+	finish_rehash();
+	write = new write_storage(m, alloc);
+	if (parallel_write) {
+		write->locks = new lock_stripes<global_lock>(stripes < m ? stripes : m);
+		setup_write_locks();
+	}
+}
+
+//!applies the adaptive spinning and the statistics settings to new write storage locks
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::setup_write_locks()
+{
+	if (write->locks != nullptr) {
+		write->locks->set_spin(lock_spin);
+		write->locks->count(lock_counting);
+	}
 }
 
-template <class K, class V>
-void kmap<K,V>::end_read_write(bool move_storage)
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::end_read_write(bool move_storage, unsigned threads)
 {
+	unsigned count = threads == 0 ? 1 : threads;
+	if (m < 2 * uint64_t(count))
+		count = 1;
 	if (move_storage)
-		move_write_storage();
+		move_write_storage(count);
 	else
-		combine_read_write();
+		combine_read_write(count);
+	if (write->locks != nullptr)
+		lock_history += write->locks->stats();
 	delete write;
 	write = nullptr;
+	//!the moved buckets can hold more than kmap_size, the table then grows once for the final size
+	if (entries > kmap_size)
+		resize(entries);
 }
 
-template <class K, class V>
-bool kmap<K,V>::move_write_batch(uint64_t index)
+template <class K, class V, class H, class I, class B, class A>
+bool kmap<K,V,H,I,B,A>::move_write_batch(uint64_t index)
 {
-	if (write->locks != nullptr)
-		write->locks[index].set_lock(true);
-	uint64_t change = write->storage[index].size() - values[index].size();
-	entries += change;
+	entries += move_bucket(index);
+	return !values[index].empty();
+}
+
+//!moves the write storage bucket over the bucket of values and returns the change in the number of entries
+template <class K, class V, class H, class I, class B, class A>
+int64_t kmap<K,V,H,I,B,A>::move_bucket(uint64_t index)
+{
+	write->set_lock(index, true);
+	if (!write->storage[index].empty() || !values[index].empty())
+		before_write(index);
+	int64_t change = int64_t(write->storage[index].size()) - int64_t(values[index].size());
 	values[index] = std::move(write->storage[index]);
+	track(index);
+	write->set_lock(index, false);
+	return change;
+}
+
+//!the buckets are independent, so every thread moves a range of them and the changes are summed at the end
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::move_write_storage(unsigned count)
+{
+	std::vector<int64_t> change(count, 0);
+	run_parallel(count, [&](unsigned t) {
+		for (uint64_t index = m * t / count; index < m * (t + 1) / count; index++)
+			change[t] += move_bucket(index);
+	});
+	for (unsigned t = 0; t < count; t++)
+		entries += change[t];
+}
+
+//!the write storage hashes like values, so its bucket i only holds keys of bucket i of values and every thread
+//!can merge a range of buckets. the table grows once before anything is merged, for every pending pair being new
+//!(counting the keys which are really new costs a search per pair, about as much as merging them)
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::combine_read_write(unsigned count)
+{
 	if (write->locks != nullptr)
-		write->locks[index].set_lock(false);
-	return !values[index].empty();
+		write->locks->set_all(true);
+
+	const uint64_t source_m = write->storage.getcapacity();
+	uint64_t pending = 0;
+	for (uint64_t index = 0; index < source_m; index++)
+		pending += write->storage[index].size();
+	if (entries + pending > kmap_size)
+		resize(entries + pending);
+
+	if (source_m == m) {
+		std::vector<int64_t> added(count, 0);
+		run_parallel(count, [&](unsigned t) {
+			for (uint64_t index = m * t / count; index < m * (t + 1) / count; index++)
+				added[t] += merge_bucket(index);
+		});
+		for (unsigned t = 0; t < count; t++)
+			entries += added[t];
+	}
+	else
+		merge_rehashed(source_m, count);
+
+	if (write->locks != nullptr)
+		write->locks->set_all(false);
 }
 
-template <class K, class V>
-void kmap<K,V>::move_write_storage()
+//!splices the pairs of the write storage bucket into the bucket of values, the new values replace the existing ones.
+//!returns the number of keys which were new
+template <class K, class V, class H, class I, class B, class A>
+int64_t kmap<K,V,H,I,B,A>::merge_bucket(uint64_t index)
 {
-	for (uint64_t index = 0; index < m; index++)
-		move_write_batch(index);
+	bucket_type& source = write->storage[index];
+	int64_t added = 0;
+	typename bucket_type::iterator it = source.begin();
+	while (it != source.end()) {
+		typename bucket_type::iterator next = it;
+		++next;
+		added += merge_node(index, source.extract(it));
+		it = next;
+	}
+	return added;
 }
 
-template <class K, class V>
-void kmap<K,V>::combine_read_write()
+//!inserts the node into the bucket at the index or assigns its value to the existing key, returns 1 if the key was new
+template <class K, class V, class H, class I, class B, class A>
+int64_t kmap<K,V,H,I,B,A>::merge_node(uint64_t index, typename bucket_type::node_type&& node)
 {
-	if (write->locks != nullptr) {
-		for (uint64_t index = 0; index < write->storage.getcapacity(); index++)
-			write->locks[index].set_lock(true);
+	before_write(index);
+	typename bucket_type::insert_return_type result = values[index].insert(std::move(node));
+	if (result.inserted) {
+		occupied.set(index);
+		return 1;
 	}
+	result.position->second = std::move(result.node.mapped());
+	return 0;
+}
 
-	for (uint64_t index = 0; index < write->storage.getcapacity(); index++) {
-		for (auto& entry: write->storage[index]) {
-			inserting(entry.first, entry.second);
+//!merge after values grew: the pairs no longer land in the bucket of the same index, so like parallel_rehash
+//!every thread first extracts a range of the write storage sorted by the thread owning the destination bucket
+//!and then inserts the pairs addressed to it
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::merge_rehashed(uint64_t source_m, unsigned count)
+{
+	if (count == 1) {
+		for (uint64_t index = 0; index < source_m; index++) {
+			bucket_type& source = write->storage[index];
+			typename bucket_type::iterator it = source.begin();
+			while (it != source.end()) {
+				typename bucket_type::iterator next = it;
+				++next;
+				uint64_t destination = bucket_index(it->first, m);
+				entries += merge_node(destination, source.extract(it));
+				it = next;
+			}
 		}
+		return;
 	}
 
-	if (write->locks != nullptr) {
-		for (uint64_t index = 0; index < write->storage.getcapacity(); index++)
-			write->locks[index].set_lock(false);
+	typedef std::vector<std::pair<uint64_t, typename bucket_type::node_type> > outbox;
+	std::vector<outbox> moved(uint64_t(count) * count); //moved[source thread * count + destination thread]
+
+	run_parallel(count, [&](unsigned t) {
+		for (uint64_t index = source_m * t / count; index < source_m * (t + 1) / count; index++) {
+			bucket_type& source = write->storage[index];
+			typename bucket_type::iterator it = source.begin();
+			while (it != source.end()) {
+				typename bucket_type::iterator next = it;
+				++next;
+				uint64_t destination = bucket_index(it->first, m);
+				moved[t * count + destination * count / m].push_back(std::make_pair(destination, source.extract(it)));
+				it = next;
+			}
+		}
+	});
+
+	std::vector<int64_t> added(count, 0);
+	run_parallel(count, [&](unsigned t) {
+		for (unsigned source = 0; source < count; source++) {
+			outbox& box = moved[source * count + t];
+			for (size_t j = 0; j < box.size(); j++)
+				added[t] += merge_node(box[j].first, std::move(box[j].second));
+			outbox().swap(box);
+		}
+	});
+	for (unsigned t = 0; t < count; t++)
+		entries += added[t];
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::concurrent_storage::concurrent_storage(uint64_t size, uint64_t stripes): locks(stripes < size ? stripes : size),
+    lock_count(size), change(0), versions(nullptr)
+{
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::concurrent_storage::~concurrent_storage()
+{
+	delete versions.load();
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::version_table::version_table(uint64_t input): size(input), buckets(new std::atomic<bucket_type*>[input])
+{
+	for (uint64_t i = 0; i < size; i++)
+		buckets[i].store(nullptr, std::memory_order_relaxed);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::version_table::~version_table()
+{
+	for (uint64_t i = 0; i < size; i++)
+		delete buckets[i].load(std::memory_order_relaxed);
+	delete[] buckets;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::delete_bucket(void* bucket)
+{
+	delete static_cast<bucket_type*>(bucket);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::delete_versions(void* table)
+{
+	delete static_cast<version_table*>(table);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::bucket_lock::bucket_lock(shared_global_lock& input, bool exclusive_input): lock(input), exclusive(exclusive_input)
+{
+	if (exclusive)
+		lock.set_lock(true);
+	else
+		lock.set_shared(true);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::bucket_lock::~bucket_lock()
+{
+	if (exclusive)
+		lock.set_lock(false);
+	else
+		lock.set_shared(false);
+}
+
+//!the write storage and concurrent mode are not meant to be used together
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::begin_concurrent(bool lock_free)
+{
+	if (shared != nullptr)
+		return;
+	//!a key has to be in the bucket it hashes to, so a running migration is finished first
+	finish_rehash();
+	if (lock_free && !std::is_copy_constructible<V>::value)
+		throw std::logic_error("lock free reads copy the buckets, the values of the kmap have to be copy constructible");
+	shared = new concurrent_storage(m, stripes);
+	if (lock_free) {
+		//!the pairs move into the first versions, values keeps its size with empty buckets
+		detach_snapshots();
+		version_table* table = new version_table(m);
+		for (uint64_t i = 0; i < m; i++) {
+			table->buckets[i].store(new bucket_type(std::move(values[i])), std::memory_order_relaxed);
+			values[i].clear();
+		}
+		shared->versions.store(table, std::memory_order_release);
 	}
 }
 
-template <class K, class V>
-void kmap<K,V>::inserting(const K& key, const V& val)
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::end_concurrent()
 {
-	if (entries == kmap_size)
+	if (shared == nullptr)
+		return;
+	entries = uint64_t(int64_t(entries) + shared->change.load());
+	version_table* table = shared->versions.load();
+	if (table != nullptr) {
+		for (uint64_t i = 0; i < m; i++) {
+			values[i] = std::move(*table->buckets[i].load(std::memory_order_relaxed));
+			track(i);
+		}
+	}
+	delete shared;
+	shared = nullptr;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+bool kmap<K,V,H,I,B,A>::concurrent() const
+{
+	return shared != nullptr;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+bool kmap<K,V,H,I,B,A>::lock_free_reads() const
+{
+	return shared != nullptr && shared->versions.load(std::memory_order_relaxed) != nullptr;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::check_references() const
+{
+	if (shared->versions.load(std::memory_order_relaxed) != nullptr)
+		throw std::logic_error("no references to the pairs of a kmap can be handed out while its reads are lock free, use visit");
+}
+
+//!replaces the version of a bucket, the replaced version is freed once no reader can reach it. the bucket lock is held
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::publish(uint64_t index, std::unique_ptr<bucket_type> bucket)
+{
+	std::atomic<bucket_type*>& slot = shared->versions.load(std::memory_order_relaxed)->buckets[index];
+	bucket_type* previous = slot.load(std::memory_order_relaxed);
+	slot.store(bucket.release(), std::memory_order_release);
+	shared->epochs.retire(previous, delete_bucket);
+}
+
+//!the new table is built from copies, readers keep on searching the old one until it is published
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::grow_versions()
+{
+	//!only reached with values which can be copied, see begin_concurrent
+	if constexpr (std::is_copy_constructible<V>::value) {
+		version_table* previous = shared->versions.load(std::memory_order_relaxed);
+		uint64_t size = I::table_size(2 * m);
+		std::unique_ptr<version_table> table(new version_table(size));
+		for (uint64_t i = 0; i < size; i++)
+			table->buckets[i].store(new bucket_type(alloc), std::memory_order_relaxed);
+		for (uint64_t i = 0; i < previous->size; i++) {
+			const bucket_type& bucket = *previous->buckets[i].load(std::memory_order_relaxed);
+			for (typename bucket_type::const_iterator it = bucket.begin(); it != bucket.end(); ++it)
+				table->buckets[bucket_index(it->first, size)].load(std::memory_order_relaxed)->try_emplace(it->first, it->second);
+		}
+		//!values only keeps the size of the table while the reads are lock free
+		values.resize(size, alloc);
+		occupied.resize(size);
+		init_hash_props();
+		all_dirty = true;
+		shared->versions.store(table.release(), std::memory_order_release);
+		shared->epochs.retire(previous, delete_versions);
+	}
+}
+
+//!a copy of a map whose reads are lock free takes its pairs from the published versions
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::copy_versions(const kmap& input)
+{
+	if (input.shared == nullptr)
+		return;
+	version_table* table = input.shared->versions.load();
+	if (table == nullptr)
+		return;
+	for (uint64_t i = 0; i < table->size; i++)
+		values[i] = bucket_type(*table->buckets[i].load(std::memory_order_relaxed), alloc);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+bool kmap<K,V,H,I,B,A>::visit(const K& key, Function fn) const
+{
+	if (shared == nullptr) {
+		const_iterator key_position = find_key(key);
+		if (!key_position.in_map())
+			return false;
+		fn(key_position->second);
+		return true;
+	}
+	if (shared->versions.load(std::memory_order_relaxed) != nullptr) {
+		//!lock free: the version read stays allocated until the guard is gone
+		epoch_guard guard(shared->epochs);
+		version_table* table = shared->versions.load(std::memory_order_acquire);
+		const bucket_type& bucket = *table->buckets[bucket_index(key, table->size)].load(std::memory_order_acquire);
+		typename bucket_type::const_iterator it = bucket.find(key);
+		if (it == bucket.end())
+			return false;
+		fn(it->second);
+		return true;
+	}
+	bucket_lock guard(key_lock(key), false);
+	const bucket_type& bucket = values[bucket_index(key, m)];
+	typename bucket_type::const_iterator it = bucket.find(key);
+	if (it == bucket.end())
+		return false;
+	fn(it->second);
+	return true;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+shared_global_lock& kmap<K,V,H,I,B,A>::key_lock(const Q& key) const
+{
+	return shared->locks[bucket_index(key, shared->lock_count)];
+}
+
+//!the locks are always taken in the same order so two threads locking all of them can't deadlock
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::lock_all(bool setting)
+{
+	shared->locks.set_all(setting);
+}
+
+//!grows the table unless another thread grew it since the table size previous_m was seen.
+//!the whole rehash is done at once since a migration would leave keys outside of their bucket
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::concurrent_grow(uint64_t previous_m)
+{
+	lock_all(true);
+	try {
+		int64_t total = int64_t(entries) + shared->change.load(std::memory_order_relaxed);
+		if (m == previous_m && total >= int64_t(kmap_size)) {
+			entries = uint64_t(total);
+			shared->change.store(0, std::memory_order_relaxed);
+			if (shared->versions.load(std::memory_order_relaxed) != nullptr)
+				grow_versions();
+			else {
+				grow();
+				finish_rehash();
+			}
+		}
+	}
+	catch (...) {
+		lock_all(false);
+		throw;
+	}
+	lock_all(false);
+}
+
+//!lookup of at and operator[] in concurrent mode, nullptr when the key isn't there. the value is handed out under
+//!the shared lock unless a view still shares the bucket: the other threads holding the shared lock can write through
+//!the references they got, so the bucket is copied into the views under the exclusive lock. the views are only
+//!added and dropped under all of the locks, so either lock is enough to check them
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+V* kmap<K,V,H,I,B,A>::locked_value(const Q& key)
+{
+	bool exclusive = false;
+	while (true) {
+		bucket_lock guard(key_lock(key), exclusive);
+		uint64_t index = bucket_index(key, m);
+		typename bucket_type::iterator it = values[index].find(key);
+		if (it == values[index].end())
+			return nullptr;
+		if (!exclusive && !snapshots.empty()) {
+			exclusive = true;
+			continue;
+		}
+		before_write(index);
+		return &it->second;
+	}
+}
+
+//!insert of concurrent mode: on_existing is called with the value when the key already exists, under the same lock
+template <class K, class V, class H, class I, class B, class A>
+template <class Existing, class Key, class... Args>
+std::pair<typename kmap<K,V,H,I,B,A>::iterator, bool> kmap<K,V,H,I,B,A>::locked_inserting(Existing on_existing, Key&& key, Args&&... args)
+{
+	for (;;) {
+		uint64_t previous_m;
 		{
-			values.resize(2 * m);
-			uint64_t old_m = m;
-			init_hash_props(); //find new m and new kmap_size
-			rehash(old_m);
+			bucket_lock guard(key_lock(key), true);
+			if (int64_t(entries) + shared->change.load(std::memory_order_relaxed) < int64_t(kmap_size)) {
+				uint64_t index = bucket_index(key, m);
+				if constexpr (std::is_copy_constructible<V>::value) {
+					version_table* table = shared->versions.load(std::memory_order_relaxed);
+					if (table != nullptr) {
+						//!lock free reads: the edit is made on a copy of the bucket which then replaces it
+						const bucket_type& current = *table->buckets[index].load(std::memory_order_relaxed);
+						bool exists = current.find(key) != current.end();
+						if (exists && std::is_same<Existing, keep_value>::value)
+							return std::pair<iterator, bool>(end(), false);
+						std::unique_ptr<bucket_type> copy(new bucket_type(current, alloc));
+						if (exists)
+							on_existing(copy->find(key)->second);
+						else
+							copy->try_emplace(std::forward<Key>(key), std::forward<Args>(args)...);
+						before_write(index);
+						publish(index, std::move(copy));
+						if (!exists)
+							shared->change.fetch_add(1, std::memory_order_relaxed);
+						return std::pair<iterator, bool>(end(), !exists);
+					}
+				}
+				//!keep_value leaves an existing pair alone, every other Existing changes it
+				if (std::is_same<Existing, keep_value>::value)
+					before_insert(index, key);
+				else
+					before_write(index);
+				std::pair<typename bucket_type::iterator, bool> result =
+					values[index].try_emplace(std::forward<Key>(key), std::forward<Args>(args)...);
+				if (result.second) {
+					shared->change.fetch_add(1, std::memory_order_relaxed);
+					occupied.set(index);
+					mark_dirty(index);
+				}
+				else
+					on_existing(result.first->second);
+				return std::pair<iterator, bool>(iterator_at(index, result.first), result.second);
+			}
+			previous_m = m;
 		}
-		//! do hashing after the rehash check, otherwise the key-value combination would get inserted into a location that will never be searched
-		unsigned long long converted = hashvalue(key);
-		uint64_t index = hashing(converted, m, a);
-		//!insert key-value combination in std::map located at index and update entries by 1
-		values[index][key] = val;
-		//std::cout<<"the key is "<<key<<" and the value is "<<values[index][key]<<std::endl; //testing if insert actually works
+		concurrent_grow(previous_m);
+	}
+}
+
+//!every insert goes through here: the value is built in place from args only when the key is new
+template <class K, class V, class H, class I, class B, class A>
+template <class Key, class... Args>
+std::pair<typename kmap<K,V,H,I,B,A>::iterator, bool> kmap<K,V,H,I,B,A>::try_inserting(Key&& key, Args&&... args)
+{
+	if (write != nullptr)
+		return write->try_inserting(std::forward<Key>(key), std::forward<Args>(args)...);
+	if (shared != nullptr)
+		return locked_inserting(keep_value(), std::forward<Key>(key), std::forward<Args>(args)...);
+	if (entries == kmap_size)
+		grow();
+	if (old_m != 0)
+		migrate_step();
+	if (old_m != 0) {
+		//!while migrating the key may still be in the bucket it was hashed to before the growth
+		uint64_t old_index = bucket_index(key, old_m);
+		if (old_index >= migrated) {
+			typename bucket_type::iterator it = values[old_index].find(key);
+			if (it != values[old_index].end())
+				return std::pair<iterator, bool>(iterator_at(old_index, it), false);
+		}
+	}
+	//! do hashing after the rehash check, otherwise the key-value combination would get inserted into a location that will never be searched
+	uint64_t index = bucket_index(key, m);
+	before_insert(index, key);
+	//!insert key-value combination in the bucket located at index and update entries by 1 if the key is new
+	std::pair<typename bucket_type::iterator, bool> result = values[index].try_emplace(std::forward<Key>(key), std::forward<Args>(args)...);
+	if (result.second) {
+		entries += 1;
+		occupied.set(index);
+		mark_dirty(index);
+	}
+	return std::pair<iterator, bool>(iterator_at(index, result.first), result.second);
+}
+
+//!inserts the pair held by a node extracted from another bucket, the value replaces the existing value if the key exists
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::inserting_node(typename bucket_type::node_type&& node)
+{
+	if (entries == kmap_size)
+		grow();
+	if (old_m != 0)
+		migrate_step();
+	if (old_m != 0) {
+		uint64_t old_index = bucket_index(node.key(), old_m);
+		if (old_index >= migrated) {
+			typename bucket_type::iterator it = values[old_index].find(node.key());
+			if (it != values[old_index].end()) {
+				before_write(old_index);
+				it->second = std::move(node.mapped());
+				return;
+			}
+		}
+	}
+	uint64_t index = bucket_index(node.key(), m);
+	before_write(index);
+	typename bucket_type::insert_return_type result = values[index].insert(std::move(node));
+	if (result.inserted) {
 		entries += 1;
+		occupied.set(index);
+	}
+	else
+		result.position->second = std::move(result.node.mapped());
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::snapshot_state::snapshot_state(const bucket_type* table, uint64_t buckets, uint64_t count,
+    uint64_t stripes, const A& input): live(table), size(buckets), entries(count),
+    copies(new std::atomic<bucket_type*>[buckets]), locks(stripes < buckets ? stripes : buckets), released(false),
+    alloc(std::allocator_traits<A>::select_on_container_copy_construction(input))
+{
+	for (uint64_t i = 0; i < size; i++)
+		copies[i].store(nullptr, std::memory_order_relaxed);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap<K,V,H,I,B,A>::snapshot_state::~snapshot_state()
+{
+	for (uint64_t i = 0; i < size; i++)
+		delete copies[i].load(std::memory_order_relaxed);
+	delete[] copies;
+}
+
+//!in concurrent mode the writers are held off by all of the locks while the view is added
+template <class K, class V, class H, class I, class B, class A>
+typename kmap<K,V,H,I,B,A>::snapshot_type kmap<K,V,H,I,B,A>::snapshot()
+{
+	if (lock_free_reads())
+		throw std::logic_error("the buckets of a kmap whose reads are lock free can't be shared, end concurrent mode first");
+	if (!std::is_copy_constructible<V>::value)
+		throw std::logic_error("snapshots copy the buckets, the values of the kmap have to be copy constructible");
+	bool locked = shared != nullptr;
+	if (locked)
+		lock_all(true);
+	std::shared_ptr<snapshot_state> state;
+	try {
+		//!the view finds a key in the bucket it hashes to
+		finish_rehash();
+		//!the states of the views which are gone are dropped here, the writes only skip them
+		for (size_t s = snapshots.size(); s-- > 0;) {
+			if (snapshots[s]->released.load(std::memory_order_relaxed))
+				snapshots.erase(snapshots.begin() + s);
+		}
+		uint64_t count = locked ? uint64_t(int64_t(entries) + shared->change.load(std::memory_order_relaxed)) : entries;
+		state = std::make_shared<snapshot_state>(&values[0], m, count, stripes, alloc);
+		snapshots.push_back(state);
+	}
+	catch (...) {
+		if (locked)
+			lock_all(false);
+		throw;
+	}
+	if (locked)
+		lock_all(false);
+	return snapshot_type(std::move(state));
+}
+
+//!every change of a bucket is announced here first, so the views sharing it can copy it and the next checkpoint
+//!writes it
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::before_write(uint64_t index)
+{
+	mark_dirty(index);
+	if (!snapshots.empty())
+		preserve(index);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::mark_dirty(uint64_t index)
+{
+	if (!all_dirty)
+		dirty.set(index);
+}
+
+//!an insert only changes the bucket when the key is new, so the views only copy the bucket then and the insert
+//!marks it dirty once the pair is in. a key which exists is announced by the iterator handing out its pair
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+void kmap<K,V,H,I,B,A>::before_insert(uint64_t index, const Q& key)
+{
+	if (!snapshots.empty() && values[index].find(key) == values[index].end())
+		preserve(index);
+}
+
+//!called by the iterators over values before they hand out a pair. in concurrent mode other threads can be
+//!changing the bucket, so it is announced under the lock of the key like at and operator[] do (see locked_value):
+//!the shared lock is enough to mark it dirty, a view which still shares it copies it under the exclusive lock
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::announce_write(void* map, uint64_t index, const K& key)
+{
+	kmap& owner = *static_cast<kmap*>(map);
+	if (owner.shared == nullptr) {
+		owner.before_write(index);
+		return;
+	}
+	{
+		bucket_lock guard(owner.key_lock(key), false);
+		if (owner.snapshots.empty()) {
+			owner.mark_dirty(index);
+			return;
+		}
+	}
+	bucket_lock guard(owner.key_lock(key), true);
+	owner.before_write(index);
+}
+
+//!a bucket which doesn't hold the key isn't changed, so it is only announced when the key is found. the search
+//!is skipped while nothing keeps track of the changes
+template <class K, class V, class H, class I, class B, class A>
+template <class Q>
+uint64_t kmap<K,V,H,I,B,A>::erase_in_bucket(uint64_t index, const Q& key)
+{
+	if (all_dirty && snapshots.empty())
+		return values[index].erase(key);
+	if (values[index].find(key) == values[index].end())
+		return 0;
+	before_write(index);
+	return values[index].erase(key);
+}
+
+//!the whole table is about to change, so the next checkpoint writes all of it
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::before_table_write()
+{
+	detach_snapshots();
+	all_dirty = true;
+}
+
+//!the bucket doesn't change while it is copied: the writers of a bucket hold its exclusive lock in concurrent mode
+//!(at, operator[] and the iterators take it while a view shares the bucket), otherwise a single thread writes to
+//!the map.
+//!values written through references handed out before the snapshot was taken aren't covered, the writers have to
+//!be done with those first
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::preserve(uint64_t index)
+{
+	for (size_t s = 0; s < snapshots.size(); s++)
+		copy_shared(*snapshots[s], index);
+}
+
+//!copies the bucket into the view unless it has a copy already. once the copy is published under the lock
+//!the readers of the view stop reading the bucket of the map, so it can be changed without the lock
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::copy_shared(snapshot_state& state, uint64_t index)
+{
+	//!only reached with values which can be copied, see snapshot
+	if constexpr (std::is_copy_constructible<V>::value) {
+		if (state.released.load(std::memory_order_relaxed) || state.copies[index].load(std::memory_order_acquire) != nullptr)
+			return;
+		bucket_lock guard(state.locks[index], true);
+		if (!state.released.load(std::memory_order_relaxed) && state.copies[index].load(std::memory_order_relaxed) == nullptr)
+			state.copies[index].store(new bucket_type(values[index], state.alloc), std::memory_order_release);
+	}
+}
+
+//!copies every bucket the views still share before the table is changed as a whole, the views then hold all of
+//!their pairs themselves and the map forgets them
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::detach_snapshots()
+{
+	for (size_t s = 0; s < snapshots.size(); s++) {
+		for (uint64_t i = 0; i < snapshots[s]->size; i++)
+			copy_shared(*snapshots[s], i);
+	}
+	snapshots.clear();
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap_snapshot<K,V,H,I,B,A>::kmap_snapshot(std::shared_ptr<state_type> input): state(std::move(input))
+{
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap_snapshot<K,V,H,I,B,A>& kmap_snapshot<K,V,H,I,B,A>::operator=(kmap_snapshot&& input)
+{
+	if (this != &input) {
+		release();
+		state = std::move(input.state);
+	}
+	return *this;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+kmap_snapshot<K,V,H,I,B,A>::~kmap_snapshot()
+{
+	release();
+}
+
+//!the copies are freed right away under all of the locks, a writer copying a bucket at the same time
+//!sees the view released once it holds the lock
+template <class K, class V, class H, class I, class B, class A>
+void kmap_snapshot<K,V,H,I,B,A>::release()
+{
+	if (state == nullptr)
+		return;
+	state->locks.set_all(true);
+	state->released.store(true, std::memory_order_relaxed);
+	for (uint64_t i = 0; i < state->size; i++)
+		delete state->copies[i].exchange(nullptr, std::memory_order_relaxed);
+	state->locks.set_all(false);
+	state.reset();
+}
+
+template <class K, class V, class H, class I, class B, class A>
+uint64_t kmap_snapshot<K,V,H,I,B,A>::entry_number() const
+{
+	return state->entries;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+bool kmap_snapshot<K,V,H,I,B,A>::empty() const
+{
+	return state->entries == 0;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+uint64_t kmap_snapshot<K,V,H,I,B,A>::hash_size() const
+{
+	return state->size;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+bool kmap_snapshot<K,V,H,I,B,A>::contains(const K& key) const
+{
+	return visit(key, [](const V&) {});
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+bool kmap_snapshot<K,V,H,I,B,A>::visit(const K& key, Function fn) const
+{
+	bool found = false;
+	read_bucket(kmap<K,V,H,I,B,A>::bucket_index(key, state->size), [&](const bucket_type& bucket) {
+		typename bucket_type::const_iterator it = bucket.find(key);
+		if (it != bucket.end()) {
+			found = true;
+			fn(it->second);
+		}
+	});
+	return found;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+void kmap_snapshot<K,V,H,I,B,A>::for_each(Function fn) const
+{
+	for_each(fn, 0, state->size);
+}
+
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+void kmap_snapshot<K,V,H,I,B,A>::for_each(Function fn, uint64_t first, uint64_t last) const
+{
+	if (last > state->size)
+		last = state->size;
+	for (uint64_t i = first; i < last; i++) {
+		read_bucket(i, [&](const bucket_type& bucket) {
+			for (typename bucket_type::const_iterator it = bucket.begin(); it != bucket.end(); ++it)
+				fn(*it);
+		});
+	}
+}
+
+//!calls fn with the copy of the bucket if the map made one, otherwise with the bucket of the map under the lock
+//!which keeps the map from changing it meanwhile
+template <class K, class V, class H, class I, class B, class A>
+template <class Function>
+void kmap_snapshot<K,V,H,I,B,A>::read_bucket(uint64_t index, Function fn) const
+{
+	const bucket_type* copy = state->copies[index].load(std::memory_order_acquire);
+	if (copy != nullptr) {
+		fn(*copy);
+		return;
+	}
+	bucket_lock guard(state->locks[index], false);
+	copy = state->copies[index].load(std::memory_order_acquire);
+	fn(copy != nullptr ? *copy : state->live[index]);
+}
+
+//!the image gets the buckets of the current table size. while a migration is running the pairs which weren't
+//!migrated yet are sorted out to their new bucket first
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::save(const std::string& path) const
+{
+	if (shared != nullptr)
+		throw std::logic_error("end concurrent mode before saving the kmap");
+	typedef const std::pair<const K, V>* pair_pointer;
+	std::vector<std::vector<pair_pointer> > stray(old_m != 0 ? m : 0);
+	for (uint64_t i = migrated; i < old_m; i++) {
+		for (typename bucket_type::const_iterator it = values[i].begin(); it != values[i].end(); ++it) {
+			uint64_t index = bucket_index(it->first, m);
+			if (index != i)
+				stray[index].push_back(&*it);
+		}
+	}
+
+	kmap_image_writer out(path);
+	kmap_image_header header;
+	header.init();
+	header.key_size = kmap_image_codec<K>::fixed_size;
+	header.value_size = kmap_image_codec<V>::fixed_size;
+	header.buckets = m;
+	header.index_check = I::index(kmap_image_header::probe, m);
+	header.sequence = checkpoints;
+	header.records = out.position();
+	bool fixed = header.key_size != 0 && header.value_size != 0;
+	std::vector<uint64_t> directory;
+	directory.reserve(m + 1);
+	std::vector<uint64_t> offsets;
+	if (!fixed)
+		offsets.reserve(entries + 1);
+	uint64_t count = 0;
+	std::vector<pair_pointer> items;
+	for (uint64_t b = 0; b < m; b++) {
+		directory.push_back(count);
+		items.clear();
+		for (typename bucket_type::const_iterator it = values[b].begin(); it != values[b].end(); ++it) {
+			if (old_m == 0 || bucket_index(it->first, m) == b)
+				items.push_back(&*it);
+		}
+		if (old_m != 0)
+			items.insert(items.end(), stray[b].begin(), stray[b].end());
+		write_bucket(out, items, offsets);
+		count += items.size();
+	}
+	directory.push_back(count);
+	if (!fixed)
+		offsets.push_back(out.position());
+	header.entries = count;
+	header.directory = out.position();
+	out.append(directory.data(), directory.size() * sizeof(uint64_t));
+	header.offsets = fixed ? 0 : out.position();
+	out.append(offsets.data(), offsets.size() * sizeof(uint64_t));
+	out.finish(header);
+}
+
+//!writes the pairs of a bucket sorted by key, so kmap_view can bisect the bucket. offsets gets the file offset
+//!of every record unless the records have a fixed size
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::write_bucket(kmap_image_writer& out, std::vector<const std::pair<const K, V>*>& items,
+                                      std::vector<uint64_t>& offsets)
+{
+	std::sort(items.begin(), items.end(), [](const std::pair<const K, V>* a, const std::pair<const K, V>* b) {
+		return kmap_image_codec<K>::compare(a->first, b->first) < 0;
+	});
+	bool fixed = kmap_image_codec<K>::fixed_size != 0 && kmap_image_codec<V>::fixed_size != 0;
+	for (size_t i = 0; i < items.size(); i++) {
+		if (!fixed)
+			offsets.push_back(out.position());
+		kmap_image_codec<K>::write(out, items[i]->first);
+		kmap_image_codec<V>::write(out, items[i]->second);
+	}
+}
+
+
+//!a record of the log holds the pairs of every bucket listed, whatever they were before
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::checkpoint(const std::string& path)
+{
+	if (shared != nullptr)
+		throw std::logic_error("end concurrent mode before checkpointing the kmap");
+	//!recovery finds every pair in the bucket it hashes to
+	finish_rehash();
+	uint64_t count = m;
+	if (!all_dirty) {
+		count = 0;
+		for (uint64_t b = dirty.next(0); b < m; b = dirty.next(b + 1))
+			count++;
+		if (count == 0)
+			return;
+	}
+	kmap_log_header header;
+	header.init();
+	header.key_size = kmap_image_codec<K>::fixed_size;
+	header.value_size = kmap_image_codec<V>::fixed_size;
+	header.buckets = m;
+	header.entries = entries;
+	header.index_check = I::index(kmap_image_header::probe, m);
+	header.sequence = checkpoints + 1;
+	header.count = count;
+	header.full = all_dirty ? 1 : 0;
+	kmap_image_writer out(path, true);
+	out.append(&header, sizeof(header));
+	if (all_dirty) {
+		for (uint64_t b = 0; b < m; b++)
+			write_log_bucket(out, b);
+	}
+	else {
+		for (uint64_t b = dirty.next(0); b < m; b = dirty.next(b + 1))
+			write_log_bucket(out, b);
+	}
+	uint64_t mark = kmap_log_header::end_mark;
+	out.append(&mark, sizeof(mark));
+	out.finish();
+	checkpoints += 1;
+	if (all_dirty) {
+		dirty = bucket_bitmap(m);
+		all_dirty = false;
+	}
+	else {
+		for (uint64_t b = dirty.next(0); b < m; b = dirty.next(b + 1))
+			dirty.reset(b);
+	}
+}
+
+//!the image counts as the next checkpoint, so recovery skips the records of the log written before it even if
+//!the machine stops before the log is emptied
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::compact(const std::string& base, const std::string& log)
+{
+	if (shared != nullptr)
+		throw std::logic_error("end concurrent mode before compacting the checkpoints of the kmap");
+	//!a migration left running would move pairs without marking their buckets
+	finish_rehash();
+	checkpoints += 1;
+	try {
+		save(base);
+	}
+	catch (...) {
+		checkpoints -= 1;
+		throw;
+	}
+	kmap_image_writer::truncate(log);
+	dirty = bucket_bitmap(m);
+	all_dirty = false;
+}
+
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::recover(const std::string& base, const std::string& log)
+{
+	if (shared != nullptr || write != nullptr)
+		throw std::logic_error("end concurrent mode and the write storage before recovering the kmap");
+	uint64_t sequence = 0;
+	try {
+		if (mapped_file::exists(base)) {
+			kmap_view<K,V,H,I> image = kmap_view<K,V,H,I>::open(base);
+			rebuild_table(image.hash_size());
+			for (typename kmap_view<K,V,H,I>::const_iterator it = image.begin(); it != image.end(); ++it) {
+				K key(it.key());
+				uint64_t index = bucket_index(key, m);
+				values[index].try_emplace(std::move(key), V(it.value()));
+				occupied.set(index);
+			}
+			entries = image.entry_number();
+			sequence = image.sequence();
+		}
+		else
+			rebuild_table(I::table_size(2));
+		if (mapped_file::exists(log))
+			replay_log(mapped_file(log), sequence);
+	}
+	catch (...) {
+		clear();
+		throw;
+	}
+	checkpoints = sequence;
+	dirty = bucket_bitmap(m);
+	all_dirty = false;
+}
+
+//!the index of the bucket and its number of pairs come first
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::write_log_bucket(kmap_image_writer& out, uint64_t index) const
+{
+	uint64_t bucket[2] = {index, uint64_t(values[index].size())};
+	out.append(bucket, sizeof(bucket));
+	for (typename bucket_type::const_iterator it = values[index].begin(); it != values[index].end(); ++it) {
+		kmap_image_codec<K>::write(out, it->first);
+		kmap_image_codec<V>::write(out, it->second);
+	}
+}
+
+//!size of the encoded T at the input, 0 if it runs past the bytes left
+template <class K, class V, class H, class I, class B, class A>
+template <class T>
+uint64_t kmap<K,V,H,I,B,A>::encoded_length(const char* input, uint64_t left)
+{
+	if (left < kmap_image_codec<T>::header_size())
+		return 0;
+	uint64_t length = kmap_image_codec<T>::length(input);
+	return length <= left ? length : 0;
+}
+
+//!size of the buckets of a record and its end mark, 0 if the record was cut short
+template <class K, class V, class H, class I, class B, class A>
+uint64_t kmap<K,V,H,I,B,A>::log_record_size(const char* input, uint64_t left, const kmap_log_header& header)
+{
+	uint64_t position = 0;
+	for (uint64_t c = 0; c < header.count; c++) {
+		uint64_t bucket[2];
+		if (left - position < sizeof(bucket))
+			return 0;
+		memcpy(bucket, input + position, sizeof(bucket));
+		position += sizeof(bucket);
+		if (bucket[0] >= header.buckets)
+			return 0;
+		for (uint64_t p = 0; p < bucket[1]; p++) {
+			uint64_t length = encoded_length<K>(input + position, left - position);
+			if (length == 0)
+				return 0;
+			position += length;
+			length = encoded_length<V>(input + position, left - position);
+			if (length == 0)
+				return 0;
+			position += length;
+		}
+	}
+	uint64_t mark;
+	if (left - position < sizeof(mark))
+		return 0;
+	memcpy(&mark, input + position, sizeof(mark));
+	return mark == kmap_log_header::end_mark ? position + sizeof(mark) : 0;
+}
+
+//!the buckets of the record replace the buckets of the map, a full record replaces the table
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::apply_log_record(const char* input, const kmap_log_header& header)
+{
+	if (header.full != 0)
+		rebuild_table(header.buckets);
+	else if (header.buckets != m)
+		throw std::runtime_error("the checkpoint log doesn't continue the base image");
+	uint64_t position = 0;
+	for (uint64_t c = 0; c < header.count; c++) {
+		uint64_t bucket[2];
+		memcpy(bucket, input + position, sizeof(bucket));
+		position += sizeof(bucket);
+		if (bucket[0] >= m)
+			throw std::runtime_error("the checkpoint log is damaged");
+		bucket_type& target = values[bucket[0]];
+		entries -= target.size();
+		target.clear();
+		for (uint64_t p = 0; p < bucket[1]; p++) {
+			K key(kmap_image_codec<K>::read(input + position));
+			position += kmap_image_codec<K>::length(input + position);
+			target.try_emplace(std::move(key), V(kmap_image_codec<V>::read(input + position)));
+			position += kmap_image_codec<V>::length(input + position);
+		}
+		entries += target.size();
+		track(bucket[0]);
+	}
+	if (entries != header.entries)
+		throw std::runtime_error("the checkpoint log doesn't continue the base image");
+}
+
+//!applies the records newer than the sequence number, which becomes the number of the last record.
+//!the log ends at the first record which is cut short, nothing after it was finished
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::replay_log(const mapped_file& file, uint64_t& sequence)
+{
+	const char* data = file.data();
+	uint64_t position = 0;
+	while (file.size() - position >= sizeof(kmap_log_header)) {
+		kmap_log_header header;
+		memcpy(&header, data + position, sizeof(header));
+		if (!header.matches())
+			return;
+		if (header.key_size != kmap_image_codec<K>::fixed_size || header.value_size != kmap_image_codec<V>::fixed_size)
+			throw std::runtime_error("the checkpoint log was written with other key or value types");
+		//!the index policy can only be asked about a table size it can produce
+		if (header.buckets == 0 || I::table_size(header.buckets) != header.buckets ||
+		    header.index_check != I::index(kmap_image_header::probe, header.buckets))
+			throw std::runtime_error("the checkpoint log was written with another index policy");
+		if (header.full != 0 && header.count != header.buckets)
+			throw std::runtime_error("the checkpoint log is damaged");
+		position += sizeof(header);
+		uint64_t size = log_record_size(data + position, file.size() - position, header);
+		if (size == 0)
+			return;
+		if (header.sequence > sequence) {
+			apply_log_record(data + position, header);
+			sequence = header.sequence;
+		}
+		position += size;
+	}
+}
+
+//!empties the map and gives it a table of the given size
+template <class K, class V, class H, class I, class B, class A>
+void kmap<K,V,H,I,B,A>::rebuild_table(uint64_t size)
+{
+	clear();
+	values = make_table(size, alloc);
+	init_hash_props();
+	track_table();
 }
 
 #endif //KMAP_H_INCLUDED
@@ -0,0 +1,138 @@
+#include "kmap_alloc.h"
+#include <stdint.h>
+
+const size_t kmap_arena::default_chunk_size = 64 * 1024;
+
+kmap_arena::kmap_arena(): chunks(nullptr), position(nullptr), limit(nullptr), chunk_size(default_chunk_size), used(0)
+{
+}
+
+kmap_arena::kmap_arena(size_t size): chunks(nullptr), position(nullptr), limit(nullptr), chunk_size(size), used(0)
+{
+    if (chunk_size < 2 * sizeof(chunk))
+        chunk_size = 2 * sizeof(chunk);
+}
+
+kmap_arena::~kmap_arena()
+{
+    release();
+}
+
+void* kmap_arena::allocate(size_t bytes, size_t align)
+{
+    lock.set_lock(true);
+    void* result = allocate_unlocked(bytes, align);
+    lock.set_lock(false);
+    return result;
+}
+
+void* kmap_arena::allocate_unlocked(size_t bytes, size_t align)
+{
+    if (bytes == 0)
+        bytes = 1;
+    if (align < alignof(chunk))
+        align = alignof(chunk);
+    uintptr_t start = (reinterpret_cast<uintptr_t>(position) + align - 1) & ~uintptr_t(align - 1);
+    if (position == nullptr || start + bytes > reinterpret_cast<uintptr_t>(limit)) {
+        //!blocks which would take most of a chunk get a chunk of their own so the current chunk isn't wasted
+        if (bytes + align > chunk_size / 4) {
+            char* block = static_cast<char*>(new_chunk(bytes + align));
+            used += bytes;
+            return reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(block) + align - 1) & ~uintptr_t(align - 1));
+        }
+        position = static_cast<char*>(new_chunk(chunk_size));
+        limit = reinterpret_cast<char*>(chunks) + sizeof(chunk) + chunk_size;
+        start = (reinterpret_cast<uintptr_t>(position) + align - 1) & ~uintptr_t(align - 1);
+    }
+    position = reinterpret_cast<char*>(start + bytes);
+    used += bytes;
+    return reinterpret_cast<void*>(start);
+}
+
+//!takes a chunk of the given size from the heap, links it in front of the chunk list and returns its first free byte
+void* kmap_arena::new_chunk(size_t size)
+{
+    chunk* block = static_cast<chunk*>(::operator new(sizeof(chunk) + size));
+    block->next = chunks;
+    chunks = block;
+    return reinterpret_cast<char*>(block) + sizeof(chunk);
+}
+
+void kmap_arena::release()
+{
+    lock.set_lock(true);
+    while (chunks != nullptr) {
+        chunk* next = chunks->next;
+        ::operator delete(chunks);
+        chunks = next;
+    }
+    position = nullptr;
+    limit = nullptr;
+    used = 0;
+    lock.set_lock(false);
+}
+
+size_t kmap_arena::allocated() const
+{
+    return used;
+}
+
+kmap_pool::kmap_pool()
+{
+    for (size_t i = 0; i < classes; i++)
+        free_lists[i] = nullptr;
+}
+
+bool kmap_pool::pooled(size_t bytes, size_t align)
+{
+    return bytes <= granularity * classes && align <= granularity;
+}
+
+void* kmap_pool::allocate(size_t bytes, size_t align)
+{
+    if (!pooled(bytes, align))
+        return ::operator new(bytes);
+    if (bytes == 0)
+        bytes = 1;
+    size_t size_class = (bytes - 1) / granularity;
+    lock.set_lock(true);
+    if (free_lists[size_class] == nullptr) {
+        //!the size class is empty, carve a batch of blocks out of the arena
+        size_t block = (size_class + 1) * granularity;
+        char* batch = static_cast<char*>(slabs.allocate(block * refill, granularity));
+        for (size_t i = 0; i < refill; i++) {
+            free_block* node = reinterpret_cast<free_block*>(batch + i * block);
+            node->next = free_lists[size_class];
+            free_lists[size_class] = node;
+        }
+    }
+    free_block* result = free_lists[size_class];
+    free_lists[size_class] = result->next;
+    lock.set_lock(false);
+    return result;
+}
+
+void kmap_pool::deallocate(void* p, size_t bytes, size_t align)
+{
+    if (!pooled(bytes, align)) {
+        ::operator delete(p);
+        return;
+    }
+    if (bytes == 0)
+        bytes = 1;
+    size_t size_class = (bytes - 1) / granularity;
+    free_block* node = static_cast<free_block*>(p);
+    lock.set_lock(true);
+    node->next = free_lists[size_class];
+    free_lists[size_class] = node;
+    lock.set_lock(false);
+}
+
+void kmap_pool::release()
+{
+    lock.set_lock(true);
+    for (size_t i = 0; i < classes; i++)
+        free_lists[i] = nullptr;
+    slabs.release();
+    lock.set_lock(false);
+}
@@ -0,0 +1,149 @@
+#ifndef KMAP_ALLOC_H_INCLUDED
+#define KMAP_ALLOC_H_INCLUDED
+
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include "global_lock.h"
+
+//!memory resources which kmap_allocator takes its memory from.
+//!both are guarded by a single lock, so threads building separate maps should each use their own resource.
+//!a resource given to a kmap belongs to that kmap: clear() and clean() hand all of its memory back at once.
+
+//!monotonic arena: allocations bump a pointer through large chunks and deallocate does nothing.
+//!the memory only comes back when release() is called (or the arena is destroyed)
+class kmap_arena
+{
+public:
+    kmap_arena();
+    explicit kmap_arena(size_t); //!size of the chunks taken from the heap
+    kmap_arena(const kmap_arena&) = delete;
+    kmap_arena& operator=(const kmap_arena&) = delete;
+    ~kmap_arena();
+    void* allocate(size_t, size_t);
+    void deallocate(void*, size_t, size_t) {}
+    void release(); //!frees every chunk
+    size_t allocated() const; //!bytes handed out since the last release
+private:
+    struct chunk
+    {
+        chunk* next;
+    };
+    static const size_t default_chunk_size;
+    chunk* chunks;
+    char* position; //!next free byte of the current chunk
+    char* limit; //!end of the current chunk
+    size_t chunk_size;
+    size_t used;
+    global_lock lock;
+    void* allocate_unlocked(size_t, size_t);
+    void* new_chunk(size_t);
+};
+
+//!size class pool: small blocks are rounded up to a multiple of granularity and recycled through one
+//!free list per size class, their memory is carved out of an arena so release() frees all of it at once.
+//!blocks larger than the biggest size class go straight to the heap
+class kmap_pool
+{
+public:
+    kmap_pool();
+    kmap_pool(const kmap_pool&) = delete;
+    kmap_pool& operator=(const kmap_pool&) = delete;
+    void* allocate(size_t, size_t);
+    void deallocate(void*, size_t, size_t);
+    void release(); //!frees every block of the size classes, the large blocks must already be deallocated
+private:
+    static const size_t granularity = 16;
+    static const size_t classes = 32; //!size classes of 16 to 512 bytes
+    static const size_t refill = 64; //!blocks carved out of the arena when a free list is empty
+    struct free_block
+    {
+        free_block* next;
+    };
+    free_block* free_lists[classes];
+    kmap_arena slabs;
+    global_lock lock;
+    static bool pooled(size_t, size_t);
+};
+
+//!allocator handing out the memory of a kmap_arena or kmap_pool.
+//!a default constructed allocator has no resource and uses the heap.
+//!the allocator moves and swaps along with the container, a copy of a container allocates from the heap
+template <class T, class Resource>
+class kmap_allocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::false_type is_always_equal;
+
+    kmap_allocator(): resource(nullptr) {};
+    kmap_allocator(Resource& input): resource(&input) {};
+    template <class U>
+    kmap_allocator(const kmap_allocator<U, Resource>& input): resource(input.resource) {};
+
+    T* allocate(size_t);
+    void deallocate(T*, size_t);
+    kmap_allocator select_on_container_copy_construction() const {return kmap_allocator();}
+    void release() const; //!releases the whole resource, does nothing for the heap
+    Resource* get_resource() const {return resource;}
+private:
+    Resource* resource;
+    template <class, class> friend class kmap_allocator;
+};
+
+template <class T>
+using kmap_arena_allocator = kmap_allocator<T, kmap_arena>;
+template <class T>
+using kmap_pool_allocator = kmap_allocator<T, kmap_pool>;
+
+template <class T, class Resource>
+T* kmap_allocator<T, Resource>::allocate(size_t n)
+{
+    if (resource == nullptr)
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    return static_cast<T*>(resource->allocate(n * sizeof(T), alignof(T)));
+}
+
+template <class T, class Resource>
+void kmap_allocator<T, Resource>::deallocate(T* p, size_t n)
+{
+    if (resource == nullptr)
+        ::operator delete(p);
+    else
+        resource->deallocate(p, n * sizeof(T), alignof(T));
+}
+
+template <class T, class Resource>
+void kmap_allocator<T, Resource>::release() const
+{
+    if (resource != nullptr)
+        resource->release();
+}
+
+template <class T, class U, class Resource>
+bool operator==(const kmap_allocator<T, Resource>& a, const kmap_allocator<U, Resource>& b)
+{
+    return a.get_resource() == b.get_resource();
+}
+
+template <class T, class U, class Resource>
+bool operator!=(const kmap_allocator<T, Resource>& a, const kmap_allocator<U, Resource>& b)
+{
+    return a.get_resource() != b.get_resource();
+}
+
+//!called by kmap once none of its buckets hold memory any more
+//!allocators without a resource of their own (std::allocator) have nothing to release
+template <class Alloc>
+void kmap_release(const Alloc&) {}
+
+template <class T, class Resource>
+void kmap_release(const kmap_allocator<T, Resource>& alloc)
+{
+    alloc.release();
+}
+
+#endif // KMAP_ALLOC_H_INCLUDED
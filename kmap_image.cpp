@@ -0,0 +1,241 @@
+#include "kmap_image.h"
+#include <stdexcept>
+#include <utility>
+#include <fstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define KMAP_IMAGE_MMAP 1
+#else
+#define KMAP_IMAGE_MMAP 0
+#endif
+
+void kmap_image_header::init()
+{
+    memset(this, 0, sizeof(*this));
+    memcpy(magic, "KMAPIMG", 8);
+    version = current_version;
+    byte_order = byte_order_mark;
+}
+
+bool kmap_image_header::matches() const
+{
+    return memcmp(magic, "KMAPIMG", 8) == 0 && version == current_version && byte_order == byte_order_mark;
+}
+
+void kmap_log_header::init()
+{
+    memset(this, 0, sizeof(*this));
+    memcpy(magic, "KMAPLOG", 8);
+    version = kmap_image_header::current_version;
+    byte_order = kmap_image_header::byte_order_mark;
+}
+
+bool kmap_log_header::matches() const
+{
+    return memcmp(magic, "KMAPLOG", 8) == 0 && version == kmap_image_header::current_version &&
+           byte_order == kmap_image_header::byte_order_mark;
+}
+
+kmap_image_writer::kmap_image_writer(const std::string& destination, bool append_input): path(destination),
+    temporary(append_input ? destination : destination + ".tmp"), written(0), start(0), appending(append_input)
+{
+    file = fopen(temporary.c_str(), appending ? "ab" : "wb");
+    if (file == nullptr)
+        throw std::runtime_error("can't create the kmap image " + temporary);
+    if (appending) {
+        if (fseek(file, 0, SEEK_END) != 0) {
+            fclose(file);
+            throw std::runtime_error("can't append to " + path);
+        }
+        start = written = uint64_t(ftell(file));
+        return;
+    }
+    //!the header is written last, its place is kept empty
+    kmap_image_header header;
+    header.init();
+    append(&header, sizeof(header));
+}
+
+kmap_image_writer::~kmap_image_writer()
+{
+    if (file != nullptr) {
+        fclose(file);
+        file = nullptr;
+        discard();
+    }
+}
+
+void kmap_image_writer::append(const void* input, uint64_t size)
+{
+    if (size != 0 && fwrite(input, 1, size, file) != size)
+        fail("can't write the kmap image ");
+    written += size;
+}
+
+void kmap_image_writer::pad()
+{
+    static const char zeros[8] = {0};
+    append(zeros, (8 - written % 8) % 8);
+}
+
+void kmap_image_writer::finish(kmap_image_header& header)
+{
+    header.file_size = written;
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, 1, sizeof(header), file) != sizeof(header))
+        fail("can't write the kmap image ");
+    //!the image has to be on the disk before it replaces the old one, or a crash could leave a torn file at path
+    bool written_out = fflush(file) == 0;
+#if KMAP_IMAGE_MMAP
+    written_out = written_out && fsync(fileno(file)) == 0;
+#endif
+    if (!written_out)
+        fail("can't write the kmap image ");
+    int closed = fclose(file);
+    file = nullptr;
+    if (closed != 0) {
+        remove(temporary.c_str());
+        throw std::runtime_error("can't write the kmap image " + temporary);
+    }
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        throw std::runtime_error("can't replace " + path + " with the kmap image");
+    }
+}
+
+void kmap_image_writer::finish()
+{
+    bool written_out = fflush(file) == 0;
+#if KMAP_IMAGE_MMAP
+    written_out = written_out && fsync(fileno(file)) == 0;
+#endif
+    if (!written_out)
+        fail("can't write the kmap image ");
+    int closed = fclose(file);
+    file = nullptr;
+    if (closed != 0) {
+        discard();
+        throw std::runtime_error("can't write the kmap image " + temporary);
+    }
+}
+
+void kmap_image_writer::truncate(const std::string& path)
+{
+    FILE* emptied = fopen(path.c_str(), "wb");
+    if (emptied == nullptr || fclose(emptied) != 0)
+        throw std::runtime_error("can't empty " + path);
+}
+
+void kmap_image_writer::fail(const char* message)
+{
+    fclose(file);
+    file = nullptr;
+    discard();
+    throw std::runtime_error(message + temporary);
+}
+
+//!an image which wasn't finished is removed, an append is cut off so the next one follows the last whole record
+void kmap_image_writer::discard()
+{
+    if (!appending) {
+        remove(temporary.c_str());
+        return;
+    }
+#if KMAP_IMAGE_MMAP
+    //!if this fails too the reader of the log still stops at the record which was cut short
+    int result = ::truncate(path.c_str(), off_t(start));
+    (void)result;
+#endif
+}
+
+mapped_file::mapped_file(): address(nullptr), length(0), mapped(false)
+{
+}
+
+mapped_file::mapped_file(const std::string& path): address(nullptr), length(0), mapped(false)
+{
+#if KMAP_IMAGE_MMAP
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        throw std::runtime_error("can't open " + path);
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        throw std::runtime_error("can't read the size of " + path);
+    }
+    length = uint64_t(status.st_size);
+    if (length != 0) {
+        void* result = mmap(nullptr, length, PROT_READ, MAP_SHARED, descriptor, 0);
+        if (result == MAP_FAILED) {
+            close(descriptor);
+            throw std::runtime_error("can't map " + path);
+        }
+        address = static_cast<const char*>(result);
+        mapped = true;
+    }
+    //!the mapping keeps the file alive on its own
+    close(descriptor);
+#else
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    if (!input)
+        throw std::runtime_error("can't open " + path);
+    length = uint64_t(input.tellg());
+    char* contents = new char[length == 0 ? 1 : length];
+    input.seekg(0);
+    if (!input.read(contents, length)) {
+        delete[] contents;
+        throw std::runtime_error("can't read " + path);
+    }
+    address = contents;
+#endif
+}
+
+bool mapped_file::exists(const std::string& path)
+{
+    FILE* probe = fopen(path.c_str(), "rb");
+    if (probe == nullptr)
+        return false;
+    fclose(probe);
+    return true;
+}
+
+mapped_file::mapped_file(mapped_file&& input) noexcept: address(input.address), length(input.length), mapped(input.mapped)
+{
+    input.address = nullptr;
+    input.length = 0;
+    input.mapped = false;
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& input) noexcept
+{
+    if (this != &input) {
+        unmap();
+        address = input.address;
+        length = input.length;
+        mapped = input.mapped;
+        input.address = nullptr;
+        input.length = 0;
+        input.mapped = false;
+    }
+    return *this;
+}
+
+mapped_file::~mapped_file()
+{
+    unmap();
+}
+
+void mapped_file::unmap()
+{
+#if KMAP_IMAGE_MMAP
+    if (mapped)
+        munmap(const_cast<char*>(address), length);
+#else
+    delete[] address;
+#endif
+    address = nullptr;
+    length = 0;
+    mapped = false;
+}
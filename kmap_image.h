@@ -0,0 +1,184 @@
+#ifndef KMAP_IMAGE_H_INCLUDED
+#define KMAP_IMAGE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+//!binary image of a kmap written by kmap::save and read in place by kmap_view (kmap_view.h).
+//!layout: the header, the records of bucket 0, 1, ... (inside a bucket sorted by key), then the directory
+//!(buckets + 1 numbers, the records of bucket b are [directory[b], directory[b + 1])) and, when a record has
+//!no fixed size, the file offset of every record followed by the end of the records.
+//!a record is the encoded key followed by the encoded value, every part starts at a multiple of 8 bytes.
+//!the numbers are written in the byte order of the machine, an image can only be read on the same kind of machine
+struct kmap_image_header
+{
+    static const uint32_t current_version = 1;
+    static const uint32_t byte_order_mark = 0x01020304;
+    char magic[8]; //"KMAPIMG" and a 0
+    uint32_t version;
+    uint32_t byte_order; //byte_order_mark as written by the machine which saved the image
+    uint64_t key_size; //fixed size of an encoded key, 0 when it varies (strings)
+    uint64_t value_size;
+    uint64_t buckets;
+    uint64_t entries;
+    uint64_t index_check; //index of a fixed hash value given by the index policy, catches a view with another policy
+    uint64_t sequence; //number of the last checkpoint held by the image (see kmap::checkpoint), 0 if there was none
+    uint64_t records; //file offset of the first record
+    uint64_t directory; //file offset of the directory
+    uint64_t offsets; //file offset of the record offsets, 0 when every record has the same size
+    uint64_t file_size;
+    static const uint64_t probe = 0x9E3779B97F4A7C15ULL; //hash value of index_check
+    void init(); //!magic, version and byte order, every number 0
+    bool matches() const; //!magic, version and byte order of this build
+};
+
+//!encoding of a key or a value in the image. trivially copyable types are stored as their bytes and read
+//!in place (view_type is a reference into the mapped file), std::string as its length and its characters
+//!(view_type is a std::string_view). compare orders the keys inside a bucket: arithmetic types and strings by <,
+//!other trivially copyable types by their bytes, which the default hash of kmap hashes as well
+template <class T, class Enable = void>
+struct kmap_image_codec
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "kmap images store trivially copyable types and std::string, specialize kmap_image_codec for others");
+    static_assert(alignof(T) <= 8, "the parts of a kmap image are aligned to 8 bytes");
+    typedef const T& view_type;
+    static const uint64_t fixed_size = (sizeof(T) + 7) / 8 * 8;
+    template <class Writer>
+    static void write(Writer& out, const T& input)
+    {
+        out.append(&input, sizeof(T));
+        out.pad();
+    }
+    static view_type read(const char* input)
+    {
+        return *reinterpret_cast<const T*>(input);
+    }
+    static uint64_t length(const char*)
+    {
+        return fixed_size;
+    }
+    static uint64_t header_size() //!bytes which have to be there before length can be called
+    {
+        return 0;
+    }
+    static int compare(const T& a, const T& b)
+    {
+        if constexpr (std::is_arithmetic<T>::value)
+            return a < b ? -1 : (b < a ? 1 : 0);
+        else
+            return memcmp(&a, &b, sizeof(T));
+    }
+};
+
+template <>
+struct kmap_image_codec<std::string>
+{
+    typedef std::string_view view_type;
+    static const uint64_t fixed_size = 0;
+    template <class Writer>
+    static void write(Writer& out, const std::string& input)
+    {
+        uint64_t size = input.size();
+        out.append(&size, sizeof(size));
+        out.append(input.data(), size);
+        out.pad();
+    }
+    static view_type read(const char* input)
+    {
+        uint64_t size;
+        memcpy(&size, input, sizeof(size));
+        return std::string_view(input + sizeof(size), size);
+    }
+    static uint64_t length(const char* input)
+    {
+        uint64_t size;
+        memcpy(&size, input, sizeof(size));
+        return sizeof(size) + (size + 7) / 8 * 8;
+    }
+    static uint64_t header_size()
+    {
+        return sizeof(uint64_t);
+    }
+    static int compare(std::string_view a, std::string_view b)
+    {
+        return a.compare(b);
+    }
+};
+
+//!header of every record of the checkpoint log written by kmap::checkpoint. the record goes on with count
+//!buckets, each one as its index, its number of pairs and the pairs encoded like the records of an image,
+//!and ends with end_mark. a record which is cut short (the machine stopped while it was written) is ignored
+struct kmap_log_header
+{
+    static const uint64_t end_mark = 0x444E45474F4C4B4DULL; //"MKLOGEND"
+    char magic[8]; //"KMAPLOG" and a 0
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t key_size;
+    uint64_t value_size;
+    uint64_t buckets; //size of the table, every bucket is in the record when it differs from the table before
+    uint64_t entries; //pairs of the map once the record is applied
+    uint64_t index_check;
+    uint64_t sequence; //1 for the first checkpoint of a map and one more for every following one
+    uint64_t count; //buckets in the record
+    uint64_t full; //1 when the record holds every bucket, the table is then rebuilt from it
+    void init();
+    bool matches() const;
+};
+
+//!writes an image through a buffered file next to the destination ("path.tmp") which replaces the destination
+//!in finish, so a reader never sees half of an image. the header is written last.
+//!appending (the second parameter true) adds to the end of the file instead, finish then flushes it to the disk.
+//!errors throw std::runtime_error, an unfinished image is removed and an unfinished append is cut off again
+class kmap_image_writer
+{
+public:
+    explicit kmap_image_writer(const std::string&, bool = false);
+    kmap_image_writer(const kmap_image_writer&) = delete;
+    kmap_image_writer& operator=(const kmap_image_writer&) = delete;
+    ~kmap_image_writer();
+    void append(const void*, uint64_t);
+    void pad(); //!zeros up to the next multiple of 8 bytes of the file
+    uint64_t position() const {return written;} //!offset in the file
+    void finish(kmap_image_header&); //!fills in file_size, writes the header and renames the file
+    void finish(); //!appending: the data is on the disk once this returns
+    static void truncate(const std::string&); //!empties the file (creating it if needed)
+private:
+    FILE* file;
+    std::string path;
+    std::string temporary;
+    uint64_t written;
+    uint64_t start; //size of the file before appending
+    bool appending;
+    void fail(const char*);
+    void discard();
+};
+
+//!read-only mapping of a whole file, the pages are only read from the disk when they are touched.
+//!without mmap (outside of POSIX systems) the file is read into memory instead
+class mapped_file
+{
+public:
+    mapped_file();
+    explicit mapped_file(const std::string&); //!throws std::runtime_error if the file can't be mapped
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file(mapped_file&&) noexcept;
+    mapped_file& operator=(mapped_file&&) noexcept;
+    ~mapped_file();
+    const char* data() const {return address;}
+    uint64_t size() const {return length;}
+    static bool exists(const std::string&);
+private:
+    const char* address;
+    uint64_t length;
+    bool mapped; //false when the contents were read into memory (or the file is empty)
+    void unmap();
+};
+
+#endif // KMAP_IMAGE_H_INCLUDED
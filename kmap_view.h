@@ -0,0 +1,194 @@
+#ifndef KMAP_VIEW_H_INCLUDED
+#define KMAP_VIEW_H_INCLUDED
+
+#include <stdint.h>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "hash_methods.h"
+#include "kmap_image.h"
+
+//!read-only kmap answering its lookups straight from a memory mapped image written by kmap::save, nothing is
+//!deserialized: open only checks the header, the pages of the buckets are read from the disk when a lookup
+//!first touches them. keys and values come out as kmap_image_codec<T>::view_type (a reference into the mapping
+//!for trivially copyable types, a std::string_view for strings), which stay valid as long as the view.
+//!H and I must be the hash and index policies of the kmap which saved the image.
+//!the view can only be moved, the moved from view can only be assigned to or destroyed
+template <class K, class V, class H = default_kmap_hash<K>, class I = fibonacci_index>
+class kmap_view
+{
+public:
+    typedef typename kmap_image_codec<K>::view_type key_view;
+    typedef typename kmap_image_codec<V>::view_type value_view;
+    static_assert(index_policy_fits<K,H,I>::value,
+                  "fractional_index only spreads hashes below 2^53, use fibonacci_index for keys which aren't integral");
+    //!walks the records in the order of the image (bucket by bucket), *it is a pair of views
+    class const_iterator
+    {
+    public:
+        const_iterator(): owner(nullptr), entry(0) {}
+        bool operator!=(const const_iterator& test) const {return entry != test.entry;}
+        bool operator==(const const_iterator& test) const {return entry == test.entry;}
+        std::pair<key_view, value_view> operator*() const {return std::pair<key_view, value_view>(key(), value());}
+        key_view key() const {return kmap_image_codec<K>::read(owner->record(entry));}
+        value_view value() const {return owner->value_at(owner->record(entry));}
+        const_iterator& operator++() {++entry; return *this;}
+        const_iterator operator++(int) {const_iterator result(*this); ++entry; return result;}
+        bool in_map() const {return owner != nullptr && entry < owner->header->entries;}
+    private:
+        const_iterator(const kmap_view* input, uint64_t position): owner(input), entry(position) {}
+        const kmap_view* owner;
+        uint64_t entry;
+        friend class kmap_view;
+    };
+
+    kmap_view(kmap_view&&) = default;
+    kmap_view& operator=(kmap_view&&) = default;
+    kmap_view(const kmap_view&) = delete;
+    kmap_view& operator=(const kmap_view&) = delete;
+    //!maps the image, throws std::runtime_error if it can't be read, isn't a kmap image of this version and
+    //!byte order, was saved with other key or value types or another index policy, or is cut short
+    static kmap_view open(const std::string&);
+    const_iterator find(const K&) const; //!end() if the key isn't in the image
+    value_view at(const K&) const; //!throws std::out_of_range if the key isn't in the image
+    bool contains(const K&) const;
+    const_iterator begin() const;
+    const_iterator end() const;
+    uint64_t entry_number() const;
+    bool empty() const;
+    uint64_t hash_size() const;
+    uint64_t sequence() const; //!number of the last checkpoint held by the image, see kmap::compact
+private:
+    explicit kmap_view(mapped_file&&);
+    mapped_file file;
+    const kmap_image_header* header;
+    const uint64_t* directory;
+    const uint64_t* offsets; //nullptr when every record has the same size
+    uint64_t stride; //size of a record when they have the same size
+    const char* record(uint64_t) const;
+    value_view value_at(const char*) const;
+};
+
+template <class K, class V, class H, class I>
+kmap_view<K,V,H,I>::kmap_view(mapped_file&& input): file(std::move(input))
+{
+    if (file.size() < sizeof(kmap_image_header))
+        throw std::runtime_error("the file is too short to be a kmap image");
+    header = reinterpret_cast<const kmap_image_header*>(file.data());
+    if (!header->matches())
+        throw std::runtime_error("the file isn't a kmap image of this version and byte order");
+    if (header->key_size != kmap_image_codec<K>::fixed_size || header->value_size != kmap_image_codec<V>::fixed_size)
+        throw std::runtime_error("the kmap image was saved with other key or value types");
+    if (header->buckets == 0 || header->buckets > file.size() / 8)
+        throw std::runtime_error("the tables of the kmap image are damaged");
+    //!the index policy can only be asked about a table size it can produce
+    if (I::table_size(header->buckets) != header->buckets || header->index_check != I::index(kmap_image_header::probe, header->buckets))
+        throw std::runtime_error("the kmap image was saved with another index policy");
+    if (header->file_size != file.size())
+        throw std::runtime_error("the kmap image is cut short");
+    //!the tables have to lie inside of the file, the records are trusted
+    bool fixed = header->offsets == 0;
+    uint64_t tables = header->directory + (header->buckets + 1) * 8 + (fixed ? 0 : (header->entries + 1) * 8);
+    if (header->directory % 8 != 0 || header->offsets % 8 != 0 || header->records < sizeof(kmap_image_header) ||
+        header->directory < header->records || (!fixed && header->offsets != header->directory + (header->buckets + 1) * 8) ||
+        tables != file.size())
+        throw std::runtime_error("the tables of the kmap image are damaged");
+    directory = reinterpret_cast<const uint64_t*>(file.data() + header->directory);
+    offsets = fixed ? nullptr : reinterpret_cast<const uint64_t*>(file.data() + header->offsets);
+    stride = header->key_size + header->value_size;
+    if (directory[header->buckets] != header->entries || (fixed && header->records + stride * header->entries != header->directory))
+        throw std::runtime_error("the tables of the kmap image are damaged");
+}
+
+template <class K, class V, class H, class I>
+kmap_view<K,V,H,I> kmap_view<K,V,H,I>::open(const std::string& path)
+{
+    return kmap_view(mapped_file(path));
+}
+
+//!the records of a bucket are sorted by key, so the bucket is searched by bisection
+template <class K, class V, class H, class I>
+typename kmap_view<K,V,H,I>::const_iterator kmap_view<K,V,H,I>::find(const K& key) const
+{
+    uint64_t index = I::index(H()(key), header->buckets);
+    uint64_t low = directory[index];
+    uint64_t high = directory[index + 1];
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        int order = kmap_image_codec<K>::compare(kmap_image_codec<K>::read(record(middle)), key);
+        if (order == 0)
+            return const_iterator(this, middle);
+        if (order < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return end();
+}
+
+template <class K, class V, class H, class I>
+typename kmap_view<K,V,H,I>::value_view kmap_view<K,V,H,I>::at(const K& key) const
+{
+    const_iterator key_position = find(key);
+    if (!key_position.in_map())
+        throw std::out_of_range("the key doesn't exist in the kmap image");
+    return key_position.value();
+}
+
+template <class K, class V, class H, class I>
+bool kmap_view<K,V,H,I>::contains(const K& key) const
+{
+    return find(key).in_map();
+}
+
+template <class K, class V, class H, class I>
+typename kmap_view<K,V,H,I>::const_iterator kmap_view<K,V,H,I>::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+template <class K, class V, class H, class I>
+typename kmap_view<K,V,H,I>::const_iterator kmap_view<K,V,H,I>::end() const
+{
+    return const_iterator(this, header->entries);
+}
+
+template <class K, class V, class H, class I>
+uint64_t kmap_view<K,V,H,I>::entry_number() const
+{
+    return header->entries;
+}
+
+template <class K, class V, class H, class I>
+bool kmap_view<K,V,H,I>::empty() const
+{
+    return header->entries == 0;
+}
+
+template <class K, class V, class H, class I>
+uint64_t kmap_view<K,V,H,I>::hash_size() const
+{
+    return header->buckets;
+}
+
+template <class K, class V, class H, class I>
+uint64_t kmap_view<K,V,H,I>::sequence() const
+{
+    return header->sequence;
+}
+
+template <class K, class V, class H, class I>
+const char* kmap_view<K,V,H,I>::record(uint64_t entry) const
+{
+    if (offsets == nullptr)
+        return file.data() + header->records + entry * stride;
+    return file.data() + offsets[entry];
+}
+
+template <class K, class V, class H, class I>
+typename kmap_view<K,V,H,I>::value_view kmap_view<K,V,H,I>::value_at(const char* input) const
+{
+    return kmap_image_codec<V>::read(input + kmap_image_codec<K>::length(input));
+}
+
+#endif // KMAP_VIEW_H_INCLUDED
@@ -2,7 +2,10 @@
 #define KVECTOR_H_INCLUDED
 
 #include <stdint.h>
+#include <string.h>
 #include <algorithm>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 template <class I>
@@ -112,8 +115,16 @@ const_kvector_iterator<I> const_kvector_iterator<I>::operator ++(int)
     return result;
 }
 
+//!kvector_relocatable tells kvector a T can be moved to new memory with memcpy and its old copy dropped
+//!without running the destructor. true for trivially copyable types, other types may specialize it
+//!(flat_bucket does, std::map doesn't because its header points to itself)
+template <class T>
+struct kvector_relocatable : std::is_trivially_copyable<T> {};
+
 //fill in methods and than fix the kvector below to work with const iterators
-//need to make sure move operations instead of assignments occur in certain procedures
+//!kvector keeps its elements in raw storage: the first built slots are constructed, the rest of the capacity isn't.
+//!the constructors and resize construct the whole capacity (kmap indexes every slot up to the capacity),
+//!reserve only grows the capacity. the size is the number of elements in use, like before
 template <class T>
 class kvector
 {
@@ -125,15 +136,22 @@ public:
     kvector(kvector&&);
     ~kvector();
     void resize(uint64_t);
+    template <class Arg>
+    void resize(uint64_t, const Arg&); //!the new slots are constructed with T(arg)
+    void reserve(uint64_t); //!grows the capacity without constructing the new slots
     void clear();
     T & operator [] (uint64_t);
     const T & operator [] (uint64_t) const;
     void push_back(T);
+    template <class... Args>
+    void emplace_back(Args&&...);
     void pop_back();
     uint64_t getsize() const;
     uint64_t getcapacity() const;
     bool empty() const;
     void clean();
+    template <class Arg>
+    void clean(const Arg&); //!the slots are constructed again with T(arg)
     void swap(kvector<T> &);
     kvector<T> & operator= (const kvector &);
     kvector<T>& operator= (kvector&&);
@@ -150,54 +168,125 @@ private:
     static const uint64_t init_length;
     uint64_t length;//!capacity
     uint64_t current;//!size
+    uint64_t built;//!number of constructed slots, never below current
+    static T* allocate(uint64_t);
+    static void deallocate(T*);
+    static void relocate(T*, T*, uint64_t);
+    void destroy();
+    void grow_to(uint64_t);
 };
 
 template <class T>
 const uint64_t kvector<T>::init_length=2;
 
+//!raw storage for the given number of slots, nothing is constructed
 template <class T>
-kvector<T>::kvector()
+T* kvector<T>::allocate(uint64_t size)
 {
-    data = new T[init_length];
-    length = init_length;
-    current = 0;
+    if (size == 0)
+        return nullptr;
+    if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        return static_cast<T*>(::operator new(size * sizeof(T), std::align_val_t(alignof(T))));
+    return static_cast<T*>(::operator new(size * sizeof(T)));
+}
+
+template <class T>
+void kvector<T>::deallocate(T* block)
+{
+    if (block == nullptr)
+        return;
+    if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        ::operator delete(block, std::align_val_t(alignof(T)));
+    else
+        ::operator delete(block);
+}
+
+//!moves size constructed elements from one block to raw slots of another, the old elements are gone afterwards
+template <class T>
+void kvector<T>::relocate(T* from, T* to, uint64_t size)
+{
+    if (kvector_relocatable<T>::value) {
+        if (size != 0)
+            memcpy(static_cast<void*>(to), static_cast<const void*>(from), size * sizeof(T));
+        return;
+    }
+    for (uint64_t i = 0; i < size; i++) {
+        new (to + i) T(std::move(from[i]));
+        from[i].~T();
+    }
+}
+
+//!destroys the constructed elements and frees the storage
+template <class T>
+void kvector<T>::destroy()
+{
+    for (uint64_t i = 0; i < built; i++)
+        data[i].~T();
+    deallocate(data);
+    data = nullptr;
+    built = 0;
+}
+
+//!moves the constructed elements into a new block of the given capacity (at least built).
+//!a capacity of 0 has no block and there are no elements to move then, nor from a kvector without a block
+template <class T>
+void kvector<T>::grow_to(uint64_t size)
+{
+    T* newdata = allocate(size);
+    if (newdata != nullptr && data != nullptr)
+        relocate(data, newdata, built);
+    deallocate(data);
+    data = newdata;
+    length = size;
+}
+
+template <class T>
+kvector<T>::kvector(): length(init_length), current(0), built(init_length)
+{
+    data = allocate(init_length);
+    for (uint64_t i = 0; i < init_length; i++)
+        new (data + i) T();
 }
 
 //!this initializes the kvector to have a certain length
 //!but does not assign certain values
 template <class T>
-kvector<T>::kvector(uint64_t _length)
+kvector<T>::kvector(uint64_t _length): length(_length), current(0), built(_length)
 {
-    data = new T[_length];
-    length = _length;
-    current = 0;
+    data = allocate(_length);
+    for (uint64_t i = 0; i < length; i++)
+        new (data + i) T();
 }
 
 //!this initializes the kvector to have a certain length
 //!but does assign certain values
 template <class T>
-kvector<T>::kvector(uint64_t _length, T val)
+kvector<T>::kvector(uint64_t _length, T val): length(_length), current(_length), built(_length)
 {
-    data = new T[_length];
-    length = _length;
-    for (uint64_t i=0; i<length; i++)
-        data[i] = T(val);
-    current = length;
+    data = allocate(_length);
+    for (uint64_t i = 0; i < length; i++)
+        new (data + i) T(val);
 }
 
+//!the elements in use are copy constructed, the other constructed slots are default constructed
 template <class T>
-kvector<T>::kvector(const kvector &input):length(input.length), current(input.current)
+kvector<T>::kvector(const kvector &input):length(input.length), current(input.current), built(input.built)
 {
-    data = new T[length];
-    for (uint64_t i = 0; i<current; i++)
-        data[i] = input.data[i];
+    data = allocate(length);
+    for (uint64_t i = 0; i < current; i++)
+        new (data + i) T(input.data[i]);
+    for (uint64_t i = current; i < built; i++)
+        new (data + i) T();
 }
 
 template <class T>
-kvector<T>::kvector(kvector&& other):length(std::move(other.length)), current(std::move(other.length))
+kvector<T>::kvector(kvector&& other):length(other.length), current(other.current), built(other.built)
 {
     data = other.data;
     other.data = nullptr; //to prevent data from being deleted
+    other.length = 0;
+    other.current = 0;
+    other.built = 0;
 }
 
 template <class T>
@@ -216,26 +305,76 @@ const T & kvector<T>::operator[](uint64_t position) const
     //!does not automatically resize the array either.
 }
 
+//!the first elements are relocated (not copied) into the new storage and only the added slots are default constructed
 template <class T>
 void kvector<T>::resize(uint64_t size)
 {
-    T* newdata= new T[size];
-    uint64_t minimum=length<size ? length : size;
-    for (uint64_t i=0; i<minimum; i++ )
-        newdata[i] = std::move(data[i]);
-    delete[] data;
-    data = newdata;
-    length = size;
+    if (size != length) {
+        for (uint64_t i = size; i < built; i++)
+            data[i].~T();
+        if (built > size)
+            built = size;
+        grow_to(size);
+    }
+    for (uint64_t i = built; i < size; i++)
+        new (data + i) T();
+    if (built < size)
+        built = size;
+    current = size;
+}
+
+template <class T>
+template <class Arg>
+void kvector<T>::resize(uint64_t size, const Arg& arg)
+{
+    if (size != length) {
+        for (uint64_t i = size; i < built; i++)
+            data[i].~T();
+        if (built > size)
+            built = size;
+        grow_to(size);
+    }
+    for (uint64_t i = built; i < size; i++)
+        new (data + i) T(arg);
+    if (built < size)
+        built = size;
     current = size;
 }
 
+template <class T>
+void kvector<T>::reserve(uint64_t size)
+{
+    if (size > length)
+        grow_to(size);
+}
+
 //!cleans the vector of all values
 template <class T>
 void kvector<T>::clean()
 {
-    T* newdata = new T[length];
-    delete[] data;
-    data = newdata;
+    for (uint64_t i = 0; i < built; i++) {
+        data[i].~T();
+        new (data + i) T();
+    }
+    for (uint64_t i = built; i < length; i++)
+        new (data + i) T();
+    if (built < length)
+        built = length;
+    current = 0;
+}
+
+template <class T>
+template <class Arg>
+void kvector<T>::clean(const Arg& arg)
+{
+    for (uint64_t i = 0; i < built; i++) {
+        data[i].~T();
+        new (data + i) T(arg);
+    }
+    for (uint64_t i = built; i < length; i++)
+        new (data + i) T(arg);
+    if (built < length)
+        built = length;
     current = 0;
 }
 
@@ -248,25 +387,30 @@ void kvector<T>::clear()
 template <class T>
 kvector<T>::~kvector()
 {
-    delete [] data;
+    destroy();
 }
 
 template <class T>
 void kvector<T>::push_back(T val)
+{
+    emplace_back(std::move(val));
+}
+
+template <class T>
+template <class... Args>
+void kvector<T>::emplace_back(Args&&... args)
 {
    if (current==length)
-   {
-        if(length==0)
-            length = 2;
-        else
-            length *= 2;
-        T* new_data = new T[length];//produce a new array
-        for (int i=0; i<current; i++)//copy values from old array into new array
-            new_data[i] = std::move(data[i]);
-        delete[] data; //delete old array
-        data = new_data; //copy new array to old array;
+       grow_to(length == 0 ? 2 : 2 * length);
+   if (current < built) {
+       //!the slot still holds an element left by pop_back
+       data[current].~T();
+       new (data + current) T(std::forward<Args>(args)...);
+   }
+   else {
+       new (data + current) T(std::forward<Args>(args)...);
+       built += 1;
    }
-   data[current] = val;
    current += 1;
 }
 
@@ -308,29 +452,40 @@ void kvector<T>::swap(kvector<T> &in)
 {
     std::swap(this->current, in.current);
     std::swap(this->length, in.length);
+    std::swap(this->built, in.built);
     std::swap(this->data, in.data);
 }
 
 template <class T>
 kvector<T> & kvector<T>::operator= (const kvector<T> &input)
 {//note cannot use copy and swap here due to the fact both speed and memory are important.
+    if (this == &input)
+        return *this;
+    destroy();
     current = input.current;
     length = input.length;
-    delete[] data;
-    data = new T[length];
-    for (int i=0; i<current; i++)
-        data[i] = input.data[i];
+    data = allocate(length);
+    for (uint64_t i = 0; i < current; i++)
+        new (data + i) T(input.data[i]);
+    for (built = current; built < input.built; built++)
+        new (data + built) T();
     return *this;
 }
 
 template <class T>
 kvector<T>& kvector<T>::operator= (kvector<T>&& input)
 {
-    current = std::move(input.current);
-    length = std::move(input.length);
-    delete[] data;
+    if (this == &input)
+        return *this;
+    destroy();
+    current = input.current;
+    length = input.length;
+    built = input.built;
     data = input.data;
     input.data = nullptr;
+    input.length = 0;
+    input.current = 0;
+    input.built = 0;
     return *this;
 }
 
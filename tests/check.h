@@ -0,0 +1,29 @@
+#ifndef KMAP_TESTS_CHECK_H_INCLUDED
+#define KMAP_TESTS_CHECK_H_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//!the tests are plain programs which stop at the first failed check, unlike assert they also check with NDEBUG
+#define KMAP_CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            abort(); \
+        } \
+    } while (0)
+
+//!checks that the statement (the rest of the arguments, it may hold commas) throws the exception type
+#define KMAP_CHECK_THROWS(exception, ...) \
+    do { \
+        bool thrown = false; \
+        try { \
+            __VA_ARGS__; \
+        } \
+        catch (const exception&) { \
+            thrown = true; \
+        } \
+        KMAP_CHECK(thrown); \
+    } while (0)
+
+#endif // KMAP_TESTS_CHECK_H_INCLUDED
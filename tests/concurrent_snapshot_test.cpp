@@ -0,0 +1,102 @@
+//!snapshots of a kmap in concurrent mode: the writers change the values of their keys through the iterators of
+//!find, operator[] and at while readers scan a view taken before, the view has to keep the values it was taken
+//!with. run it under -fsanitize=thread as well.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. concurrent_snapshot_test.cpp ../*.cpp -o concurrent_snapshot_test && ./concurrent_snapshot_test
+#include "kmap.h"
+#include "check.h"
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const int writers = 4;
+static const int readers = 2;
+static const uint64_t keys = 20000;
+static const int rounds = 2;
+static const int phases = 10;
+//!every round adds this much to every value
+static const uint64_t step = 4;
+
+//!every writer owns the keys equal to its number modulo writers, so no value is written by two threads
+template <class Map>
+static void write(Map& map, int thread)
+{
+    for (int r = 0; r < rounds; r++) {
+        for (uint64_t k = thread; k < keys; k += writers) {
+            typename Map::iterator it = map.find(k);
+            it->second += 1;
+            (*it).second += 1;
+            map[k] += 1;
+            map.at(k) += 1;
+        }
+    }
+}
+
+//!keys are added and removed in the buckets the other writers change (under the exclusive lock) until they are done
+template <class Map>
+static void churn(Map& map, const std::atomic<bool>& done)
+{
+    for (uint64_t k = keys; !done.load(); k = k + 1 < keys * 2 ? k + 1 : keys) {
+        map.insert(k, k);
+        map.remove(k);
+    }
+}
+
+//!the view was taken when every value was key * 10 + base
+template <class View>
+static void read(const View& view, uint64_t base, const std::atomic<bool>& done)
+{
+    do {
+        uint64_t pairs = 0;
+        view.for_each([&](const std::pair<const uint64_t, uint64_t>& pair) {
+            KMAP_CHECK(pair.second == pair.first * 10 + base);
+            pairs++;
+        });
+        KMAP_CHECK(pairs == keys && view.entry_number() == keys);
+        for (uint64_t k = 0; k < keys; k += 97)
+            KMAP_CHECK(view.visit(k, [&](uint64_t value) { KMAP_CHECK(value == k * 10 + base); }));
+    } while (!done.load());
+}
+
+//!the table stays small so the writers often reach a bucket the views share while it is changed.
+//!with flat_buckets an insert can move the values of its bucket, so keys are only added to map_buckets
+template <class Map>
+static void run(bool inserts)
+{
+    Map map;
+    for (uint64_t k = 0; k < keys; k++)
+        map.insert(k, k * 10);
+    map.begin_concurrent();
+    for (int phase = 0; phase < phases; phase++) {
+        uint64_t base = phase * rounds * step;
+        typename Map::snapshot_type view = map.snapshot();
+        std::atomic<bool> done(false);
+        std::vector<std::thread> writing;
+        std::vector<std::thread> others;
+        for (int t = 0; t < writers; t++)
+            writing.emplace_back([&map, t] { write(map, t); });
+        if (inserts)
+            others.emplace_back([&map, &done] { churn(map, done); });
+        for (int t = 0; t < readers; t++)
+            others.emplace_back([&view, base, &done] { read(view, base, done); });
+        for (uint64_t t = 0; t < writing.size(); t++)
+            writing[t].join();
+        done = true;
+        for (uint64_t t = 0; t < others.size(); t++)
+            others[t].join();
+        read(view, base, done);
+    }
+    map.end_concurrent();
+    KMAP_CHECK(map.entry_number() == keys);
+    for (uint64_t k = 0; k < keys; k++)
+        KMAP_CHECK(map.at(k) == k * 10 + phases * rounds * step);
+}
+
+int main()
+{
+    run<kmap<uint64_t, uint64_t> >(true);
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >(false);
+    puts("concurrent_snapshot_test passed");
+    return 0;
+}
@@ -0,0 +1,212 @@
+//!flat_group with the instruction set the compiler enables (SSE2 or AVX2) against the portable scalar loop of
+//!KMAP_SIMD=0: the masks of both have to agree, and flat_bucket built on either has to give the same results
+//!as std::map for the same inserts, erases and lookups. the scalar version is the same header included a second
+//!time under other names, so both are in one program.
+//!build and run from this directory (add -mavx2 for the 32 byte groups):
+//!g++ -std=c++17 -O2 -pthread -I.. flat_group_test.cpp ../*.cpp -o flat_group_test && ./flat_group_test
+#include "flat_bucket.h"
+static const int simd_level = KMAP_SIMD;
+#undef FLAT_BUCKET_H_INCLUDED
+#undef KMAP_SIMD
+#define KMAP_SIMD 0
+#define flat_group scalar_flat_group
+#define flat_bucket scalar_flat_bucket
+#define flat_buckets scalar_flat_buckets
+#include "flat_bucket.h"
+#undef flat_group
+#undef flat_bucket
+#undef flat_buckets
+#include "check.h"
+#include <stdint.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+//!puts every key on one of a few probe sequences with the same fingerprint, so the groups fill up and the
+//!erases have to leave tombstones in them
+struct clustered_hash
+{
+    unsigned long long operator()(uint64_t key) const
+    {
+        return key % 5;
+    }
+};
+
+//!the mask of width bytes made of scalar masks of 16 bytes
+static uint32_t scalar_mask(const signed char* group, uint32_t (*match)(const signed char*))
+{
+    uint32_t mask = 0;
+    for (uint64_t part = 0; part < flat_group::width; part += scalar_flat_group::width)
+        mask |= match(group + part) << part;
+    return mask;
+}
+
+static uint32_t scalar_match_empty(const signed char* group)
+{
+    return scalar_flat_group::match_empty(group);
+}
+
+static uint32_t scalar_match_free(const signed char* group)
+{
+    return scalar_flat_group::match_free(group);
+}
+
+//!control bytes made of empty, deleted and fingerprints, with long runs of each
+static void masks()
+{
+    std::mt19937_64 random(1);
+    const signed char values[] = {flat_group::empty, flat_group::deleted, 0, 1, 63, 126, 127};
+    std::vector<signed char> group(flat_group::width);
+    for (int round = 0; round < 200000; round++) {
+        int kinds = 1 + random() % 7;
+        for (uint64_t i = 0; i < flat_group::width; i++)
+            group[i] = values[random() % kinds];
+        KMAP_CHECK(flat_group::match_empty(group.data()) == scalar_mask(group.data(), scalar_match_empty));
+        KMAP_CHECK(flat_group::match_free(group.data()) == scalar_mask(group.data(), scalar_match_free));
+        signed char tag = values[2 + random() % 5];
+        uint32_t mask = 0;
+        for (uint64_t part = 0; part < flat_group::width; part += scalar_flat_group::width)
+            mask |= scalar_flat_group::match(group.data() + part, tag) << part;
+        KMAP_CHECK(flat_group::match(group.data(), tag) == mask);
+        if (mask != 0)
+            KMAP_CHECK(flat_group::first(mask) == scalar_flat_group::first(mask));
+    }
+}
+
+template <class Bucket>
+static std::vector<uint64_t> keys_in_order(const Bucket& bucket)
+{
+    std::vector<uint64_t> keys;
+    for (typename Bucket::const_iterator it = bucket.begin(); it != bucket.end(); ++it)
+        keys.push_back((*it).first);
+    return keys;
+}
+
+//!checks the contents of both buckets against std::map. with groups of the same width the pairs are in the
+//!same slots, so the buckets iterate in the same order
+template <class Simd, class Scalar>
+static void check_same(const Simd& simd, const Scalar& scalar, const std::map<uint64_t, uint64_t>& expected)
+{
+    KMAP_CHECK(simd.size() == expected.size() && scalar.size() == expected.size());
+    std::vector<uint64_t> simd_keys = keys_in_order(simd);
+    std::vector<uint64_t> scalar_keys = keys_in_order(scalar);
+    if (flat_group::width == scalar_flat_group::width)
+        KMAP_CHECK(simd_keys == scalar_keys);
+    std::sort(simd_keys.begin(), simd_keys.end());
+    std::sort(scalar_keys.begin(), scalar_keys.end());
+    std::vector<uint64_t> expected_keys;
+    for (std::map<uint64_t, uint64_t>::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+        expected_keys.push_back(it->first);
+        KMAP_CHECK(simd.find(it->first)->second == it->second);
+        KMAP_CHECK(scalar.find(it->first)->second == it->second);
+    }
+    KMAP_CHECK(simd_keys == expected_keys && scalar_keys == expected_keys);
+}
+
+//!random inserts, erases and lookups on keys below range, every result compared with std::map
+template <class H>
+static void sequence(uint64_t seed, uint64_t range, int steps)
+{
+    typedef flat_bucket<uint64_t, uint64_t, H> simd_bucket;
+    typedef scalar_flat_bucket<uint64_t, uint64_t, H> scalar_bucket;
+    simd_bucket simd;
+    scalar_bucket scalar;
+    std::map<uint64_t, uint64_t> expected;
+    std::mt19937_64 random(seed);
+    for (int step = 0; step < steps; step++) {
+        uint64_t key = random() % range;
+        uint64_t value = random();
+        int choice = random() % 100;
+        if (choice < 30) {
+            bool inserted = expected.emplace(key, value).second;
+            KMAP_CHECK(simd.try_emplace(key, value).second == inserted);
+            KMAP_CHECK(scalar.try_emplace(key, value).second == inserted);
+        }
+        else if (choice < 40) {
+            expected[key] += 1;
+            simd[key] += 1;
+            scalar[key] += 1;
+        }
+        else if (choice < 75) {
+            uint64_t erased = expected.erase(key);
+            KMAP_CHECK(simd.erase(key) == erased);
+            KMAP_CHECK(scalar.erase(key) == erased);
+        }
+        else if (choice < 90) {
+            bool found = expected.count(key) != 0;
+            KMAP_CHECK((simd.find(key) != simd.end()) == found);
+            KMAP_CHECK((scalar.find(key) != scalar.end()) == found);
+        }
+        else if (choice < 98) {
+            //!a pair taken out and put back lands in the first free slot of its probe sequence
+            if (expected.count(key) != 0) {
+                typename simd_bucket::node_type simd_node = simd.extract(simd.find(key));
+                typename scalar_bucket::node_type scalar_node = scalar.extract(scalar.find(key));
+                KMAP_CHECK(simd.find(key) == simd.end() && scalar.find(key) == scalar.end());
+                KMAP_CHECK(simd.insert(std::move(simd_node)).inserted);
+                KMAP_CHECK(scalar.insert(std::move(scalar_node)).inserted);
+            }
+        }
+        else if (choice < 99) {
+            simd_bucket simd_copy(simd);
+            scalar_bucket scalar_copy(scalar);
+            check_same(simd_copy, scalar_copy, expected);
+        }
+        else if (random() % 8 == 0) {
+            expected.clear();
+            simd.clear();
+            scalar.clear();
+        }
+        KMAP_CHECK(simd.size() == expected.size() && scalar.size() == expected.size());
+        if (step % 64 == 0)
+            check_same(simd, scalar, expected);
+    }
+    check_same(simd, scalar, expected);
+}
+
+//!fills a bucket, erases every other key and checks that the ones behind the tombstones are still found:
+//!a slot may only go back to empty when its group has an empty slot, since a lookup stops at such a group
+template <class H>
+static void erase_rules(uint64_t count)
+{
+    flat_bucket<uint64_t, uint64_t, H> simd;
+    scalar_flat_bucket<uint64_t, uint64_t, H> scalar;
+    std::map<uint64_t, uint64_t> expected;
+    for (uint64_t key = 0; key < count; key++) {
+        simd.try_emplace(key, key);
+        scalar.try_emplace(key, key);
+        expected.emplace(key, key);
+    }
+    for (uint64_t key = 0; key < count; key += 2) {
+        KMAP_CHECK(simd.erase(key) == 1 && scalar.erase(key) == 1);
+        expected.erase(key);
+        for (uint64_t other = key + 1; other < count; other += 2)
+            KMAP_CHECK(simd.find(other) != simd.end() && scalar.find(other) != scalar.end());
+    }
+    check_same(simd, scalar, expected);
+    //!the freed slots are used again before the bucket grows
+    for (uint64_t key = 0; key < count; key += 2) {
+        simd.try_emplace(key, key);
+        scalar.try_emplace(key, key);
+        expected.emplace(key, key);
+    }
+    check_same(simd, scalar, expected);
+}
+
+int main()
+{
+    printf("groups of %d bytes (KMAP_SIMD %d) against %d bytes (KMAP_SIMD 0)\n", int(flat_group::width),
+           simd_level, int(scalar_flat_group::width));
+    masks();
+    for (uint64_t count = 1; count < 300; count += 7) {
+        erase_rules<clustered_hash>(count);
+        erase_rules<default_kmap_hash<uint64_t> >(count);
+    }
+    for (uint64_t seed = 0; seed < 20; seed++) {
+        sequence<clustered_hash>(seed, 100, 20000);
+        sequence<default_kmap_hash<uint64_t> >(seed, 2000, 20000);
+    }
+    puts("flat_group_test passed");
+    return 0;
+}
@@ -0,0 +1,144 @@
+//!index policies: the buckets the keys of a kmap land in.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. index_policy_test.cpp ../*.cpp -o index_policy_test && ./index_policy_test
+#include "kmap.h"
+#include "check.h"
+#include <stdint.h>
+#include <vector>
+
+//!inserts the keys and checks that every one is found and that they are spread over the buckets:
+//!at least the given share of the buckets is used and no bucket holds more than limit times the average
+template <class I, class K>
+static void check_spread(const std::vector<K>& keys, double used, double limit)
+{
+    kmap<K, uint64_t, default_kmap_hash<K>, I> map;
+    for (uint64_t i = 0; i < keys.size(); i++)
+        map.insert(keys[i], i);
+    KMAP_CHECK(map.entry_number() == keys.size());
+    for (uint64_t i = 0; i < keys.size(); i++)
+        KMAP_CHECK(map.at(keys[i]) == i);
+    uint64_t buckets = 0;
+    uint64_t largest = 0;
+    for (uint64_t b = 0; b < map.hash_size(); b++) {
+        uint64_t size = map.batch(b).size();
+        buckets += size != 0;
+        largest = size > largest ? size : largest;
+    }
+    double average = double(keys.size()) / map.hash_size();
+    KMAP_CHECK(buckets >= used * map.hash_size());
+    KMAP_CHECK(largest <= limit * average);
+}
+
+//!negative keys: fractional_index places -k where the original kmap did (by fabs), fibonacci_index uses all
+//!64 bits of the sign extended key, both spread them and keep -k apart from k
+static void negative_keys()
+{
+    default_kmap_hash<long long> hash;
+    default_kmap_hash<long> long_hash;
+    default_kmap_hash<int> int_hash;
+    for (uint64_t m = 2; m <= (uint64_t(1) << 20); m = m * 3 / 2 + 1) {
+        for (long long k = 1; k < 2000; k++) {
+            uint64_t original = hashing(hashvalue(-k), m, fractional_index::a);
+            KMAP_CHECK(fractional_index::index(hash(-k), m) == original);
+            KMAP_CHECK(fractional_index::index(long_hash(long(-k)), m) == original);
+            KMAP_CHECK(fractional_index::index(int_hash(int(-k)), m) == original);
+        }
+    }
+    for (long long k = 1; k < 2000; k++)
+        KMAP_CHECK(hash(-k) != hash(k));
+    //!the keys -1 ... -6 of a table of 1024 buckets
+    std::vector<uint64_t> seen;
+    for (long long k = 1; k <= 6; k++) {
+        uint64_t index = fractional_index::index(hash(-k), 1024);
+        for (uint64_t i = 0; i < seen.size(); i++)
+            KMAP_CHECK(seen[i] != index);
+        seen.push_back(index);
+    }
+
+    std::vector<long long> keys;
+    for (long long k = 1; k <= 200000; k++)
+        keys.push_back(-k);
+    check_spread<fractional_index>(keys, 0.99, 2);
+    check_spread<fibonacci_index>(keys, 0.99, 2);
+    for (long long k = 1; k <= 200000; k++)
+        keys.push_back(k);
+    check_spread<fractional_index>(keys, 0.99, 2);
+    check_spread<fibonacci_index>(keys, 0.99, 2);
+}
+
+//!fibonacci_index only works with power of 2 tables: table_size returns the smallest one which holds the size
+static void table_sizes()
+{
+    for (uint64_t size = 0; size < 5000; size++) {
+        uint64_t m = fibonacci_index::table_size(size);
+        KMAP_CHECK(m >= 2 && (m & (m - 1)) == 0);
+        KMAP_CHECK(m >= size && (m == 2 || m / 2 < size));
+        KMAP_CHECK(fractional_index::table_size(size) == (size < 2 ? 2 : size));
+    }
+    for (unsigned bits = 1; bits < 62; bits++) {
+        uint64_t power = uint64_t(1) << bits;
+        KMAP_CHECK(fibonacci_index::table_size(power - 1) == (bits == 1 ? 2 : power));
+        KMAP_CHECK(fibonacci_index::table_size(power) == power);
+        KMAP_CHECK(fibonacci_index::table_size(power + 1) == power * 2);
+        KMAP_CHECK(fibonacci_index::log2(power) == bits);
+    }
+    //!the tables kmap builds while it grows and after resize
+    kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index> map(1000);
+    for (uint64_t i = 0; i < 100000; i++) {
+        map.insert(i, i);
+        KMAP_CHECK((map.hash_size() & (map.hash_size() - 1)) == 0);
+    }
+    map.resize(300000);
+    KMAP_CHECK((map.hash_size() & (map.hash_size() - 1)) == 0);
+}
+
+//!every index is inside the table
+static void index_range()
+{
+    for (uint64_t m = 2; m <= (uint64_t(1) << 40); m <<= 1)
+        for (uint64_t key = 0; key < 1000; key++) {
+            KMAP_CHECK(fibonacci_index::index(key * 0x9e3779b97f4a7c15ULL, m) < m);
+            KMAP_CHECK(fibonacci_index::index(~key, m) < m);
+        }
+    for (uint64_t m = 2; m <= 100000; m = m * 3 / 2 + 1)
+        for (uint64_t key = 0; key < 1000; key++) {
+            KMAP_CHECK(fractional_index::index(key * 7919, m) < m);
+            KMAP_CHECK(fractional_index::index(~key, m) < m);
+        }
+}
+
+//!sequential and strided keys: fibonacci_index spreads every stride, powers of 2 included, and keys above 2^53.
+//!fractional_index is only checked with keys which stay below 2^53, the limit of its double precision
+static void distribution()
+{
+    const uint64_t count = 200000;
+    const uint64_t strides[] = {1, 2, 3, 8, 64, 1000, 1024, 4096, 65536, uint64_t(1) << 20, uint64_t(1) << 32, 1000003};
+    for (uint64_t s = 0; s < sizeof(strides) / sizeof(strides[0]); s++) {
+        std::vector<uint64_t> keys;
+        for (uint64_t i = 0; i < count; i++)
+            keys.push_back(i * strides[s]);
+        check_spread<fibonacci_index>(keys, 0.99, 2);
+        if (strides[s] <= 65536)
+            check_spread<fractional_index>(keys, 0.99, 2);
+    }
+    //!sequential keys with a large offset: above 2^53 fractional_index loses the low bits
+    std::vector<uint64_t> high;
+    for (uint64_t i = 0; i < count; i++)
+        high.push_back((uint64_t(1) << 60) + i);
+    check_spread<fibonacci_index>(high, 0.99, 2);
+    std::vector<long long> strided_negative;
+    for (long long i = 1; i <= (long long)count; i++)
+        strided_negative.push_back(-i * 1024);
+    check_spread<fibonacci_index>(strided_negative, 0.99, 2);
+    check_spread<fractional_index>(strided_negative, 0.99, 2);
+}
+
+int main()
+{
+    negative_keys();
+    table_sizes();
+    index_range();
+    distribution();
+    puts("index_policy_test passed");
+    return 0;
+}
@@ -0,0 +1,221 @@
+//!kmap::checkpoint, compact and recover: the recovered map has to be identical to the map at its last checkpoint,
+//!with the same table size and the same pairs in every bucket.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. kmap_checkpoint_test.cpp ../*.cpp -o kmap_checkpoint_test && ./kmap_checkpoint_test
+#include "kmap.h"
+#include "check.h"
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include <iterator>
+
+static const char* base_path = "kmap_checkpoint_test.img";
+static const char* log_path = "kmap_checkpoint_test.log";
+
+static uint64_t file_size(const char* path)
+{
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    return input ? uint64_t(input.tellg()) : 0;
+}
+
+static std::string read_file(const char* path)
+{
+    std::ifstream input(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const char* path, const std::string& contents, uint64_t size)
+{
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output.write(contents.data(), std::streamsize(size));
+}
+
+template <class Map>
+static void check_identical(const Map& expected, const Map& found)
+{
+    KMAP_CHECK(expected.hash_size() == found.hash_size());
+    KMAP_CHECK(expected.entry_number() == found.entry_number());
+    for (uint64_t b = 0; b < expected.hash_size(); b++) {
+        const typename Map::bucket_type& left = expected.batch(b);
+        const typename Map::bucket_type& right = found.batch(b);
+        KMAP_CHECK(left.size() == right.size());
+        for (typename Map::bucket_type::const_iterator it = left.begin(); it != left.end(); ++it) {
+            typename Map::bucket_type::const_iterator match = right.find(it->first);
+            KMAP_CHECK(match != right.end());
+            KMAP_CHECK(match->second == it->second);
+        }
+    }
+}
+
+template <class Map>
+static void check_recovered(const Map& expected)
+{
+    Map found;
+    found.recover(base_path, log_path);
+    check_identical(expected, found);
+}
+
+static void start()
+{
+    remove(base_path);
+    remove(log_path);
+}
+
+//!compact, then several checkpoints of a few buckets each
+static void incremental()
+{
+    typedef kmap<uint64_t, uint64_t> map_type;
+    start();
+    map_type map;
+    for (uint64_t i = 0; i < 20000; i++)
+        map.insert(i, i * 3);
+    map.compact(base_path, log_path);
+    KMAP_CHECK(file_size(log_path) == 0);
+    check_recovered(map);
+    uint64_t base = file_size(base_path);
+    for (uint64_t round = 0; round < 8; round++) {
+        for (uint64_t i = 0; i < 20; i++) {
+            map.remove(round * 1000 + i * 7);
+            map.insert_or_assign(round * 1000 + i * 11 + 1, round);
+            map.try_emplace(100000 + round * 100 + i, i);
+        }
+        map.find(round + 5000)->second = round;
+        map.checkpoint(log_path);
+        check_recovered(map);
+    }
+    KMAP_CHECK(file_size(log_path) < base);
+    //!reads and removes of missing keys change nothing, so nothing is written
+    uint64_t written = file_size(log_path);
+    const map_type& reader = map;
+    for (uint64_t i = 0; i < 20000; i++) {
+        KMAP_CHECK(map.find(i + 1).in_map() == reader.find(i + 1).in_map());
+        map.remove(i + 1000000);
+    }
+    for (map_type::iterator it = map.begin(); it != map.end(); ++it)
+        ;
+    map.checkpoint(log_path);
+    KMAP_CHECK(file_size(log_path) == written);
+    //!a recovered map goes on with the same files
+    map_type recovered;
+    recovered.recover(base_path, log_path);
+    recovered.insert(7, 7);
+    recovered.remove(8);
+    recovered.checkpoint(log_path);
+    check_recovered(recovered);
+}
+
+//!growth, resize, clear and incremental rehashing replace the table, the next checkpoint writes all of it
+static void whole_table()
+{
+    typedef kmap<uint64_t, uint64_t> map_type;
+    start();
+    map_type map;
+    map.incremental_rehash(2);
+    for (uint64_t i = 0; i < 5000; i++)
+        map.insert(i, i);
+    map.checkpoint(log_path);
+    for (uint64_t i = 5000; i < 60000; i++) {
+        map.insert(i, i);
+        if (i % 7001 == 0)
+            map.checkpoint(log_path);
+    }
+    map.checkpoint(log_path);
+    check_recovered(map);
+    map.resize(200000);
+    map.checkpoint(log_path);
+    check_recovered(map);
+    map.clear();
+    map.insert(1, 1);
+    map.checkpoint(log_path);
+    check_recovered(map);
+}
+
+//!a record cut short by a crash is ignored, and so are the records older than the base image
+static void crashes()
+{
+    typedef kmap<std::string, std::string> map_type;
+    start();
+    map_type map;
+    for (int i = 0; i < 3000; i++)
+        map.insert("key" + std::to_string(i), std::string(i % 17, 'v'));
+    map.compact(base_path, log_path);
+    map.insert_or_assign("key1", "changed");
+    map.remove("key2");
+    map.checkpoint(log_path);
+    map_type before = map;
+    uint64_t whole = file_size(log_path);
+    map.insert("last", std::string(1000, 'x'));
+    map.checkpoint(log_path);
+    std::string log = read_file(log_path);
+    for (uint64_t cut = whole; cut < log.size(); cut += 61) {
+        write_file(log_path, log, cut);
+        check_recovered(before);
+    }
+    write_file(log_path, log, log.size());
+    check_recovered(map);
+
+    //!the machine stopped after compact wrote the image but before it emptied the log
+    map.remove("key3");
+    map.compact(base_path, log_path);
+    write_file(log_path, log, log.size());
+    check_recovered(map);
+}
+
+//!the checkpoints follow concurrent mode, the write storage and copies
+static void other_modes()
+{
+    typedef kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> map_type;
+    start();
+    map_type map(50000);
+    for (uint64_t i = 0; i < 10000; i++)
+        map.insert(i, i);
+    map.checkpoint(log_path);
+    map.begin_concurrent();
+    for (uint64_t i = 0; i < 100; i++) {
+        map.insert(20000 + i, 1);
+        map.remove(i);
+    }
+    KMAP_CHECK_THROWS(std::logic_error, map.checkpoint(log_path));
+    map.end_concurrent();
+    map.checkpoint(log_path);
+    check_recovered(map);
+    map.begin_concurrent(true);
+    for (uint64_t i = 0; i < 100; i++) {
+        map.insert(30000 + i, 1);
+        map.remove(100 + i);
+    }
+    map.end_concurrent();
+    map.checkpoint(log_path);
+    check_recovered(map);
+    map.begin_read_write(false);
+    for (uint64_t i = 0; i < 100; i++)
+        map.insert(40000 + i, 2);
+    map.end_read_write(false);
+    map.checkpoint(log_path);
+    check_recovered(map);
+    map_type copy = map;
+    copy.insert(123456, 1);
+    copy.checkpoint(log_path);
+    check_recovered(copy);
+}
+
+int main()
+{
+    incremental();
+    whole_table();
+    crashes();
+    other_modes();
+    //!a log of other types is refused and leaves the map empty
+    start();
+    kmap<std::string, uint64_t> other;
+    other.insert("one", 1);
+    other.checkpoint(log_path);
+    kmap<uint64_t, uint64_t> wrong;
+    wrong.insert(1, 1);
+    KMAP_CHECK_THROWS(std::runtime_error, wrong.recover("kmap_checkpoint_test.missing", log_path));
+    KMAP_CHECK(wrong.empty());
+    remove(base_path);
+    remove(log_path);
+    puts("kmap_checkpoint_test passed");
+    return 0;
+}
@@ -0,0 +1,138 @@
+//!round trip of kmap::save and kmap_view (kmap_image.h, kmap_view.h) for fixed size and std::string keys.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. kmap_image_test.cpp ../*.cpp -o kmap_image_test && ./kmap_image_test
+#include "kmap.h"
+#include "kmap_view.h"
+#include "check.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+static const char* image_path = "kmap_image_test.img";
+
+template <class T>
+static T owned(const T& input)
+{
+    return input;
+}
+
+static std::string owned(std::string_view input)
+{
+    return std::string(input);
+}
+
+//!saves the map, then every pair of the view has to be in the map and every pair of the map in the view
+template <class Map, class View>
+static void round_trip(Map& map)
+{
+    map.save(image_path);
+    View view = View::open(image_path);
+    KMAP_CHECK(view.entry_number() == map.entry_number());
+    KMAP_CHECK(view.hash_size() == map.hash_size());
+    uint64_t count = 0;
+    for (typename View::const_iterator it = view.begin(); it != view.end(); ++it) {
+        typename Map::const_iterator found = static_cast<const Map&>(map).find(owned(it.key()));
+        KMAP_CHECK(found.in_map());
+        KMAP_CHECK(found->second == owned(it.value()));
+        count++;
+    }
+    KMAP_CHECK(count == map.entry_number());
+    const Map& input = map;
+    for (typename Map::const_iterator it = input.begin(); it != input.end(); ++it) {
+        KMAP_CHECK(view.contains(it->first));
+        KMAP_CHECK(owned(view.at(it->first)) == it->second);
+        KMAP_CHECK(view.find(it->first).in_map());
+    }
+}
+
+static void fixed_size()
+{
+    kmap<uint64_t, double> map;
+    for (uint64_t i = 0; i < 100000; i++)
+        map.insert(i * 31, i * 0.5);
+    round_trip<kmap<uint64_t, double>, kmap_view<uint64_t, double> >(map);
+    kmap_view<uint64_t, double> view = kmap_view<uint64_t, double>::open(image_path);
+    KMAP_CHECK(view.at(31 * 7) == 3.5);
+    KMAP_CHECK(!view.contains(5));
+    KMAP_CHECK(!view.find(5).in_map());
+    KMAP_CHECK_THROWS(std::out_of_range, view.at(5));
+    //!a view saved with other types or another index policy isn't opened
+    KMAP_CHECK_THROWS(std::runtime_error, kmap_view<uint64_t, std::string>::open(image_path));
+    typedef kmap_view<uint64_t, double, default_kmap_hash<uint64_t>, fractional_index> fractional_view;
+    KMAP_CHECK_THROWS(std::runtime_error, fractional_view::open(image_path));
+
+    kmap<int64_t, int32_t, default_kmap_hash<int64_t>, fibonacci_index, flat_buckets> flat;
+    for (int64_t i = -5000; i < 5000; i++)
+        flat.insert(i * 1000003, int32_t(i));
+    round_trip<kmap<int64_t, int32_t, default_kmap_hash<int64_t>, fibonacci_index, flat_buckets>,
+               kmap_view<int64_t, int32_t> >(flat);
+
+    kmap<int, int> empty;
+    empty.save(image_path);
+    kmap_view<int, int> empty_view = kmap_view<int, int>::open(image_path);
+    KMAP_CHECK(empty_view.empty());
+    KMAP_CHECK(!(empty_view.begin() != empty_view.end()));
+}
+
+static void strings()
+{
+    typedef kmap<std::string, std::string, default_kmap_hash<std::string>, fibonacci_index, flat_buckets> string_map;
+    string_map map;
+    for (int i = 0; i < 20000; i++)
+        map.insert("key" + std::to_string(i), std::string(i % 37, char('a' + i % 26)));
+    map.insert("", "empty key");
+    round_trip<string_map, kmap_view<std::string, std::string> >(map);
+    kmap_view<std::string, std::string> view = kmap_view<std::string, std::string>::open(image_path);
+    KMAP_CHECK(view.at("key123") == std::string(123 % 37, char('a' + 123 % 26)));
+    KMAP_CHECK(view.at("") == "empty key");
+    KMAP_CHECK(!view.contains("nokey"));
+
+    kmap<std::string, uint64_t> mixed;
+    for (uint64_t i = 0; i < 1000; i++)
+        mixed.insert(std::to_string(i), i);
+    round_trip<kmap<std::string, uint64_t>, kmap_view<std::string, uint64_t> >(mixed);
+}
+
+//!the pairs which weren't migrated yet are saved in their new bucket
+static void migration()
+{
+    kmap<uint64_t, uint64_t> map;
+    map.incremental_rehash(1);
+    for (uint64_t i = 0; i < 5000 || !map.rehashing(); i++)
+        map.insert(i, i);
+    KMAP_CHECK(map.rehashing());
+    round_trip<kmap<uint64_t, uint64_t>, kmap_view<uint64_t, uint64_t> >(map);
+}
+
+//!a damaged image is refused instead of being read
+static void damaged()
+{
+    kmap<uint64_t, uint64_t> map;
+    for (uint64_t i = 0; i < 1000; i++)
+        map.insert(i, i);
+    map.save(image_path);
+    FILE* file = fopen(image_path, "r+b");
+    KMAP_CHECK(file != nullptr);
+    uint64_t buckets = 3; //!not a table size of fibonacci_index
+    fseek(file, long(offsetof(kmap_image_header, buckets)), SEEK_SET);
+    fwrite(&buckets, sizeof(buckets), 1, file);
+    fclose(file);
+    KMAP_CHECK_THROWS(std::runtime_error, kmap_view<uint64_t, uint64_t>::open(image_path));
+    map.save(image_path);
+    file = fopen(image_path, "ab");
+    fputc(0, file);
+    fclose(file);
+    KMAP_CHECK_THROWS(std::runtime_error, kmap_view<uint64_t, uint64_t>::open(image_path));
+    KMAP_CHECK_THROWS(std::runtime_error, kmap_view<uint64_t, uint64_t>::open("kmap_image_test.missing"));
+}
+
+int main()
+{
+    fixed_size();
+    strings();
+    migration();
+    damaged();
+    remove(image_path);
+    puts("kmap_image_test passed");
+    return 0;
+}
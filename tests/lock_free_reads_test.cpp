@@ -0,0 +1,121 @@
+//!begin_concurrent(true): readers visit the map without locks while writers insert, remove and assign, and the
+//!table grows under them. run it under -fsanitize=thread as well.
+//!build and run from this directory:
+//!g++ -std=c++17 -O2 -pthread -I.. lock_free_reads_test.cpp ../*.cpp -o lock_free_reads_test && ./lock_free_reads_test
+#include "kmap.h"
+#include "check.h"
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int writers = 2;
+static const int readers = 3;
+static const int steps = 20000;
+//!keys below this are always in the map, the writers only assign them
+static const uint64_t stable = 1000;
+
+template <class Map>
+static void write(Map& map, int thread)
+{
+    for (int i = 0; i < steps; i++) {
+        uint64_t key = stable + uint64_t(thread) * steps + i;
+        map.insert(key, key * 2);
+        if (i % 3 == 0)
+            map.remove(key);
+        if (i % 5 == 0)
+            map.insert_or_assign(uint64_t(i) % stable, uint64_t(i) % stable);
+        map.try_emplace(uint64_t(i) % stable, 7);
+    }
+}
+
+template <class Map>
+static void read(const Map& map, const std::atomic<bool>& done)
+{
+    while (!done.load()) {
+        for (uint64_t i = 0; i < stable; i++) {
+            bool found = map.visit(i, [&](const uint64_t& value) { KMAP_CHECK(value == i); });
+            KMAP_CHECK(found);
+        }
+        uint64_t keys[8] = {1, 2, 3, 4, 5, 6, 7, 5000000};
+        bool found[8];
+        map.contains_batch(keys, 8, found);
+        KMAP_CHECK(found[0] && found[6] && !found[7]);
+    }
+}
+
+template <class Map>
+static uint64_t count(const Map& map)
+{
+    uint64_t pairs = 0;
+    for (typename Map::const_iterator it = map.begin(); it != map.end(); ++it)
+        pairs++;
+    return pairs;
+}
+
+template <class Map>
+static void run()
+{
+    Map map;
+    for (uint64_t i = 0; i < stable; i++)
+        map.insert(i, i);
+    map.begin_concurrent(true);
+    KMAP_CHECK(map.lock_free_reads());
+    //!references into the map would outlive the versions of their buckets
+    KMAP_CHECK_THROWS(std::logic_error, map.find(uint64_t(1)));
+    KMAP_CHECK_THROWS(std::logic_error, map[uint64_t(1)]);
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < writers; t++)
+        threads.emplace_back([&map, t] { write(map, t); });
+    for (int t = 0; t < readers; t++)
+        threads.emplace_back([&map, &done] { read(static_cast<const Map&>(map), done); });
+    for (int t = 0; t < writers; t++)
+        threads[t].join();
+    done = true;
+    for (int t = writers; t < writers + readers; t++)
+        threads[t].join();
+
+    uint64_t expected = stable + uint64_t(writers) * (steps - (steps + 2) / 3);
+    KMAP_CHECK(map.entry_number() == expected);
+    Map copy(map);
+    KMAP_CHECK(copy.entry_number() == expected && !copy.concurrent());
+    map.end_concurrent();
+    KMAP_CHECK(count(map) == expected);
+    KMAP_CHECK(count(copy) == expected);
+    for (int t = 0; t < writers; t++)
+        for (int i = 0; i < steps; i++)
+            KMAP_CHECK(map.find(stable + uint64_t(t) * steps + i).in_map() == (i % 3 != 0));
+
+    //!clear and clean keep lock free reads on
+    map.begin_concurrent(true);
+    map.clear();
+    KMAP_CHECK(map.lock_free_reads() && map.entry_number() == 0);
+    map.insert(1, 1);
+    map.clean();
+    KMAP_CHECK(map.entry_number() == 0);
+    map.insert(2, 2);
+    Map assigned;
+    assigned = map;
+    KMAP_CHECK(assigned.entry_number() == 1 && assigned.at(2) == 2);
+}
+
+int main()
+{
+    run<kmap<uint64_t, uint64_t> >();
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fibonacci_index, flat_buckets> >();
+    run<kmap<uint64_t, uint64_t, default_kmap_hash<uint64_t>, fractional_index> >();
+
+    kmap<std::string, int> strings;
+    strings.begin_concurrent(true);
+    strings.insert("a", 1);
+    strings.insert(std::string("b"), 2);
+    int value = 0;
+    KMAP_CHECK(strings.visit("a", [&](int found) { value = found; }) && value == 1);
+    strings.remove("a");
+    KMAP_CHECK(strings.entry_number() == 1 && !strings.visit("a", [](int) {}));
+    puts("lock_free_reads_test passed");
+    return 0;
+}
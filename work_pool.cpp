@@ -0,0 +1,159 @@
+#include "work_pool.h"
+
+work_pool::work_pool(unsigned count): threads(count == 0 ? 1 : count), queues(new queue[threads]), queued(0), stopping(false)
+{
+    workers.reserve(threads - 1);
+    try {
+        for (unsigned t = 0; t + 1 < threads; t++)
+            workers.push_back(std::thread(&work_pool::work, this, t));
+    }
+    catch (...) {
+        {
+            std::lock_guard<std::mutex> hold(sleep_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+        delete[] queues;
+        throw;
+    }
+}
+
+work_pool::~work_pool()
+{
+    {
+        std::lock_guard<std::mutex> hold(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+    workers.clear();
+    delete[] queues;
+    queues = nullptr;
+}
+
+unsigned work_pool::size() const
+{
+    return threads;
+}
+
+work_pool& work_pool::standard()
+{
+    static work_pool result(std::thread::hardware_concurrency());
+    return result;
+}
+
+void work_pool::run(uint64_t n, const std::function<void(uint64_t)>& fn)
+{
+    if (n == 0)
+        return;
+    batch job;
+    job.fn = &fn;
+    job.remaining.store(n, std::memory_order_relaxed);
+    //!a single thread or a single task needs no deques
+    if (threads == 1 || n == 1) {
+        for (uint64_t i = 0; i < n; i++)
+            execute(task{&job, i});
+        if (job.error)
+            std::rethrow_exception(job.error);
+        return;
+    }
+
+    //!if a deque can't take its block the tasks which were dealt are still run before the error is rethrown
+    std::exception_ptr failed;
+    uint64_t dealt = 0;
+    for (unsigned q = 0; q < threads && !failed; q++) {
+        queue& target = queues[q];
+        uint64_t pushed = 0;
+        target.lock.set_lock(true);
+        try {
+            for (uint64_t i = n * q / threads; i < n * (q + 1) / threads; i++) {
+                target.tasks.push_back(task{&job, i});
+                pushed += 1;
+            }
+        }
+        catch (...) {
+            failed = std::current_exception();
+        }
+        queued.fetch_add(pushed, std::memory_order_seq_cst);
+        target.lock.set_lock(false);
+        dealt += pushed;
+    }
+    if (dealt != n)
+        job.remaining.fetch_sub(n - dealt, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> hold(sleep_lock);
+    }
+    wake.notify_all();
+
+    //!the caller works through its own block and then steals until every task of its batch is done
+    task next;
+    while (job.remaining.load(std::memory_order_acquire) != 0) {
+        if (take(threads - 1, next))
+            execute(next);
+        else
+            std::this_thread::yield();
+    }
+    if (failed)
+        std::rethrow_exception(failed);
+    if (job.error)
+        std::rethrow_exception(job.error);
+}
+
+//!the owner works down from the back of its block and thieves take from the front,
+//!so they only compete for the same task when the deque is almost empty
+bool work_pool::take(unsigned own, task& result)
+{
+    for (unsigned i = 0; i < threads; i++) {
+        queue& source = queues[(own + i) % threads];
+        source.lock.set_lock(true);
+        if (!source.tasks.empty()) {
+            if (i == 0) {
+                result = source.tasks.back();
+                source.tasks.pop_back();
+            }
+            else {
+                result = source.tasks.front();
+                source.tasks.pop_front();
+            }
+            source.lock.set_lock(false);
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        source.lock.set_lock(false);
+    }
+    return false;
+}
+
+void work_pool::execute(const task& input)
+{
+    batch& job = *input.owner;
+    try {
+        (*job.fn)(input.index);
+    }
+    catch (...) {
+        job.error_lock.set_lock(true);
+        if (!job.error)
+            job.error = std::current_exception();
+        job.error_lock.set_lock(false);
+    }
+    //!the batch lives on the stack of its caller, which may return as soon as this reaches 0
+    job.remaining.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void work_pool::work(unsigned own)
+{
+    task next;
+    for (;;) {
+        if (take(own, next)) {
+            execute(next);
+            continue;
+        }
+        std::unique_lock<std::mutex> hold(sleep_lock);
+        wake.wait(hold, [this]() {return stopping || queued.load(std::memory_order_seq_cst) != 0;});
+        if (stopping)
+            return;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef WORK_POOL_H_INCLUDED
+#define WORK_POOL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "global_lock.h"
+
+//!work stealing thread pool: run(n, fn) calls fn(0) ... fn(n-1) on the threads of the pool and waits for them.
+//!the tasks are dealt out in contiguous blocks, one deque per thread. a thread takes its own tasks from the back
+//!and once it runs out steals from the front of the other deques, so a thread which got the slow tasks is helped
+//!by the others. the calling thread works on the tasks as well, so a pool of n threads starts n-1 of its own.
+//!any number of threads may call run at once (fn may call run too), their tasks share the deques
+class work_pool
+{
+public:
+    explicit work_pool(unsigned); //!number of threads including the caller of run, 0 is taken as 1
+    work_pool(const work_pool&) = delete;
+    work_pool& operator=(const work_pool&) = delete;
+    ~work_pool(); //!no run may be going on any more
+    //!the first exception thrown by fn is rethrown once all of the tasks are done
+    void run(uint64_t, const std::function<void(uint64_t)>&);
+    unsigned size() const; //!number of threads including the caller
+    static work_pool& standard(); //!pool of std::thread::hardware_concurrency() threads made on first use
+private:
+    struct batch
+    {
+        const std::function<void(uint64_t)>* fn;
+        std::atomic<uint64_t> remaining; //tasks not finished yet
+        std::exception_ptr error;
+        global_lock error_lock;
+    };
+    struct task
+    {
+        batch* owner;
+        uint64_t index;
+    };
+    struct alignas(64) queue
+    {
+        std::deque<task> tasks;
+        global_lock lock;
+    };
+    unsigned threads;
+    queue* queues; //one per thread, the last one belongs to the callers of run
+    std::vector<std::thread> workers;
+    std::atomic<uint64_t> queued; //tasks in the deques, the workers sleep while it is 0
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    bool stopping;
+    bool take(unsigned, task&);
+    void execute(const task&);
+    void work(unsigned);
+};
+
+#endif // WORK_POOL_H_INCLUDED